@@ -1,22 +1,21 @@
 #include "fb_allocator.h"
 #include "DataTypes.h"
 #include "Fault.h"
+#include "Atomic.h"
+#include "Clock.h"
 #include <string.h>
 
-// Define USE_LOCK to use the default lock implementation
+// Define USE_LOCKS to guard each allocator instance with its own spin lock.
+// Allocators never share a lock, so threads using different allocators do 
+// not contend.
 #define USE_LOCKS
 #ifdef USE_LOCKS
-    #include "LockGuard.h"
-    static LOCK_HANDLE _hLock;
+    #define ALLOC_LOCK(_self_)      SPIN_Lock(&(_self_)->lock)
+    #define ALLOC_UNLOCK(_self_)    SPIN_Unlock(&(_self_)->lock)
 #else
     #pragma message("WARNING: Define software lock.")
-    typedef int LOCK_HANDLE;
-    static LOCK_HANDLE _hLock;
-
-    #define LK_CREATE()     (1)
-    #define LK_DESTROY(h)  
-    #define LK_LOCK(h)    
-    #define LK_UNLOCK(h)  
+    #define ALLOC_LOCK(_self_)
+    #define ALLOC_UNLOCK(_self_)
 #endif
 
 // Get a pointer to the client's area within a memory block
@@ -30,6 +29,83 @@
 static void* ALLOC_NewBlock(ALLOC_Allocator* alloc);
 static void ALLOC_Push(ALLOC_Allocator* alloc, void* pBlock);
 static void* ALLOC_Pop(ALLOC_Allocator* alloc);
+static void* ALLOC_Get(ALLOC_Allocator* alloc);
+static void ALLOC_Put(ALLOC_Allocator* alloc, void* pBlock, struct ALLOC_Slab** ppRelease);
+static BOOL ALLOC_Grow(ALLOC_Allocator* alloc);
+static void ALLOC_ReleaseSlabs(ALLOC_Allocator* alloc, struct ALLOC_Slab* pSlabs);
+static UINT32 ALLOC_GetBatch(ALLOC_Allocator* alloc, UINT32 count, void* blocks[]);
+static void ALLOC_PutBatch(ALLOC_Allocator* alloc, UINT32 count, void* const blocks[]);
+
+#ifdef USE_ALLOC_OVERFLOW
+#include <stdlib.h>
+
+// An overflow slab. The blocks follow the header, which is padded to a whole
+// cache line so that blocks keep the alignment of the static pool.
+typedef struct ALLOC_Slab
+{
+    struct ALLOC_Slab* pNext;
+    void* pMemory;              // Address returned by malloc()
+    char* pEnd;                 // End of the slab's blocks
+    ALLOC_Block* pHead;         // Slab free-list
+    UINT32 poolIndex;
+    UINT32 maxBlocks;
+    UINT32 blocksInUse;
+} ALLOC_Slab;
+
+#define ALLOC_SLAB_HEADER_SIZE \
+    ALLOC_ROUND_UP(sizeof(ALLOC_Slab), ALLOC_CACHE_LINE_SIZE)
+
+// Get the first block of a slab
+#define ALLOC_SLAB_BLOCKS(_slab_) \
+    ((char*)(_slab_) + ALLOC_SLAB_HEADER_SIZE)
+
+static void* ALLOC_SlabPop(ALLOC_Allocator* alloc);
+static void ALLOC_SlabPush(ALLOC_Allocator* alloc, void* pBlock, ALLOC_Slab** ppRelease);
+
+// Told of each slab added or released. Set once by ALLOC_SetSlabObserver().
+static volatile ALLOC_SlabObserverFuncType _slabObserver;
+#endif
+
+// Is the block within the allocator's static pool?
+#define ALLOC_IN_POOL(_self_, _block_) \
+    ((const char*)(_block_) >= (_self_)->pPool && \
+     (const char*)(_block_) < (_self_)->pPool + (_self_)->blockSize * (_self_)->maxBlocks)
+
+// Registered allocators, newest first. Allocators are only ever added, so
+// the list can be walked without a lock.
+static ALLOC_Allocator* volatile _registry;
+static SPIN_LOCK _registryLock = SPIN_LOCK_INIT;
+
+static void ALLOC_Failed(ALLOC_Allocator* alloc);
+
+#ifdef USE_ALLOC_MAGAZINES
+#include "ThreadLocal.h"
+
+// Blocks moved between a magazine and the shared free list at a time
+#define ALLOC_MAGAZINE_BATCH    (ALLOC_MAGAZINE_SIZE / 2)
+
+// ALLOC_Allocator::magazineId of an allocator that does not use magazines
+#define ALLOC_NO_MAGAZINE       ((UINT32)-1)
+
+// A thread's cache of free blocks for one allocator
+typedef struct
+{
+    UINT32 count;
+    UINT32 allocations;     // Not yet added to the allocator's statistics
+    UINT32 deallocations;   // Not yet added to the allocator's statistics
+    INT32 maxHeld;          // Peak of allocations - deallocations
+    void* blocks[ALLOC_MAGAZINE_SIZE];
+} ALLOC_Magazine;
+
+static THREAD_LOCAL ALLOC_Magazine _magazines[ALLOC_MAX_MAGAZINES];
+static ALLOC_Allocator* _magazineOwners[ALLOC_MAX_MAGAZINES];
+static volatile UINT32 _magazineCount;
+
+static ALLOC_Magazine* ALLOC_GetMagazine(ALLOC_Allocator* self);
+static void ALLOC_Refill(ALLOC_Allocator* self, ALLOC_Magazine* mag);
+static void ALLOC_Drain(ALLOC_Allocator* self, ALLOC_Magazine* mag, UINT32 count);
+static void ALLOC_TrackHeld(ALLOC_Magazine* mag);
+#endif
 
 //----------------------------------------------------------------------------
 // ALLOC_NewBlock
@@ -38,8 +114,6 @@ static void* ALLOC_NewBlock(ALLOC_Allocator* self)
 {
     ALLOC_Block* pBlock = NULL;
 
-    LK_LOCK(_hLock);
-
     // If we have not exceeded the pool maximum
     if (self->poolIndex < self->maxBlocks)
     {
@@ -47,14 +121,6 @@ static void* ALLOC_NewBlock(ALLOC_Allocator* self)
         pBlock = (void*)(self->pPool + (self->poolIndex++ * self->blockSize));
     }
 
-    LK_UNLOCK(_hLock);
-
-    if (!pBlock)
-    {
-        // Out of fixed block memory
-        ASSERT();
-    }
-
     return pBlock;
 } 
 
@@ -63,21 +129,14 @@ static void* ALLOC_NewBlock(ALLOC_Allocator* self)
 //----------------------------------------------------------------------------
 static void ALLOC_Push(ALLOC_Allocator* self, void* pBlock)
 {
-    if (!pBlock)
-        return;
-
     // Get a pointer to the client's location within the block
     ALLOC_Block* pClient = (ALLOC_Block*)GET_CLIENT_PTR(pBlock);
 
-    LK_LOCK(_hLock);
-
     // Point client block's next pointer to head
     pClient->pNext = self->pHead;
 
     // The client block is now the new head
     self->pHead = pClient;
-
-    LK_UNLOCK(_hLock); 
 }
 
 //----------------------------------------------------------------------------
@@ -87,8 +146,6 @@ static void* ALLOC_Pop(ALLOC_Allocator* self)
 {
     ALLOC_Block* pBlock = NULL;
 
-    LK_LOCK(_hLock);
-
     // Is the free-list empty?
     if (self->pHead)
     {
@@ -99,16 +156,441 @@ static void* ALLOC_Pop(ALLOC_Allocator* self)
         self->pHead = self->pHead->pNext;
     }
 
-    LK_UNLOCK(_hLock); 
     return GET_BLOCK_PTR(pBlock);
 } 
 
+#ifdef USE_ALLOC_OVERFLOW
+//----------------------------------------------------------------------------
+// ALLOC_SlabPop
+//----------------------------------------------------------------------------
+static void* ALLOC_SlabPop(ALLOC_Allocator* self)
+{
+    ALLOC_Slab* pSlab;
+    void* pBlock = NULL;
+
+    // Take a block from the newest slab with a free block
+    for (pSlab = self->pSlabs; pSlab; pSlab = pSlab->pNext)
+    {
+        if (pSlab->pHead)
+        {
+            pBlock = pSlab->pHead;
+            pSlab->pHead = pSlab->pHead->pNext;
+        }
+        else if (pSlab->poolIndex < pSlab->maxBlocks)
+        {
+            pBlock = ALLOC_SLAB_BLOCKS(pSlab) + (pSlab->poolIndex++ * self->blockSize);
+        }
+
+        if (pBlock)
+        {
+            if (pSlab->blocksInUse++ == 0)
+                self->spareSlabs--;
+            self->overflowAllocations++;
+            break;
+        }
+    }
+
+    return pBlock;
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_SlabPush
+//----------------------------------------------------------------------------
+static void ALLOC_SlabPush(ALLOC_Allocator* self, void* pBlock, ALLOC_Slab** ppRelease)
+{
+    ALLOC_Slab** ppSlab;
+    ALLOC_Slab* pSlab;
+
+    // Find the slab holding the block
+    for (ppSlab = &self->pSlabs; *ppSlab; ppSlab = &(*ppSlab)->pNext)
+    {
+        pSlab = *ppSlab;
+        if ((char*)pBlock >= ALLOC_SLAB_BLOCKS(pSlab) && (char*)pBlock < pSlab->pEnd)
+        {
+            ((ALLOC_Block*)pBlock)->pNext = pSlab->pHead;
+            pSlab->pHead = (ALLOC_Block*)pBlock;
+
+            if (--pSlab->blocksInUse == 0)
+            {
+#ifdef ALLOC_OVERFLOW_RELEASE
+                // Unless kept as a spare, move the slab to the release list. 
+                // The caller frees it after unlocking.
+                if (self->spareSlabs >= ALLOC_OVERFLOW_SPARE_SLABS)
+                {
+                    *ppSlab = pSlab->pNext;
+                    pSlab->pNext = *ppRelease;
+                    *ppRelease = pSlab;
+                    self->slabCount--;
+                    self->slabReleases++;
+                    return;
+                }
+#endif
+                self->spareSlabs++;
+            }
+            return;
+        }
+    }
+
+    // Block not allocated by this allocator
+    ASSERT();
+}
+#endif
+
+//----------------------------------------------------------------------------
+// ALLOC_Get
+//----------------------------------------------------------------------------
+static void* ALLOC_Get(ALLOC_Allocator* self)
+{
+    // Get a block from the free-list
+    void* pBlock = ALLOC_Pop(self);
+
+    // If the free-list empty?
+    if (!pBlock)
+    {
+        // Get a new block from the pool
+        pBlock = ALLOC_NewBlock(self);
+    }
+
+#ifdef USE_ALLOC_OVERFLOW
+    // If the pool is exhausted, get a block from an overflow slab
+    if (!pBlock)
+        pBlock = ALLOC_SlabPop(self);
+#endif
+
+    return pBlock;
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_Put
+//----------------------------------------------------------------------------
+static void ALLOC_Put(ALLOC_Allocator* self, void* pBlock, struct ALLOC_Slab** ppRelease)
+{
+#ifdef USE_ALLOC_OVERFLOW
+    // Return an overflow block to its slab. An emptied slab may be added 
+    // to the ppRelease list.
+    if (!ALLOC_IN_POOL(self, pBlock))
+    {
+        ALLOC_SlabPush(self, pBlock, ppRelease);
+        return;
+    }
+#else
+    (void)ppRelease;
+#endif
+
+    // Push the block onto a stack (i.e. the free-list)
+    ALLOC_Push(self, pBlock);
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_Grow
+//----------------------------------------------------------------------------
+static BOOL ALLOC_Grow(ALLOC_Allocator* self)
+{
+#ifdef USE_ALLOC_OVERFLOW
+    ALLOC_Slab* pSlab;
+    void* pMemory;
+    UINT32 maxBlocks = ALLOC_MAX(self->maxBlocks, ALLOC_OVERFLOW_MIN_BLOCKS);
+
+    // Allocate the slab outside the lock. Over-allocate to align the header.
+    pMemory = malloc(ALLOC_SLAB_HEADER_SIZE + self->blockSize * maxBlocks + ALLOC_CACHE_LINE_SIZE);
+    if (!pMemory)
+        return FALSE;
+
+    pSlab = (ALLOC_Slab*)ALLOC_ROUND_UP((size_t)pMemory, ALLOC_CACHE_LINE_SIZE);
+    pSlab->pMemory = pMemory;
+    pSlab->pEnd = ALLOC_SLAB_BLOCKS(pSlab) + self->blockSize * maxBlocks;
+    pSlab->pHead = NULL;
+    pSlab->poolIndex = 0;
+    pSlab->maxBlocks = maxBlocks;
+    pSlab->blocksInUse = 0;
+
+    // Announce the slab before any of its blocks can be allocated
+    if (_slabObserver)
+        _slabObserver(self, ALLOC_SLAB_BLOCKS(pSlab), pSlab->pEnd, TRUE);
+
+    ALLOC_LOCK(self);
+    if (self->slabCount >= ALLOC_OVERFLOW_MAX_SLABS)
+    {
+        // Too many overflow slabs. The caller asserts out of memory.
+        ALLOC_UNLOCK(self);
+        if (_slabObserver)
+            _slabObserver(self, ALLOC_SLAB_BLOCKS(pSlab), pSlab->pEnd, FALSE);
+        free(pMemory);
+        return FALSE;
+    }
+    pSlab->pNext = self->pSlabs;
+    self->pSlabs = pSlab;
+    self->slabCount++;
+    self->spareSlabs++;
+    if (self->slabCount > self->maxSlabCount)
+        self->maxSlabCount = self->slabCount;
+    ALLOC_UNLOCK(self);
+
+    return TRUE;
+#else
+    (void)self;
+    return FALSE;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_ReleaseSlabs
+//----------------------------------------------------------------------------
+static void ALLOC_ReleaseSlabs(ALLOC_Allocator* self, struct ALLOC_Slab* pSlabs)
+{
+#ifdef USE_ALLOC_OVERFLOW
+    // Free a list of unlinked slabs outside the allocator lock
+    while (pSlabs)
+    {
+        ALLOC_Slab* pNext = pSlabs->pNext;
+        if (_slabObserver)
+            _slabObserver(self, ALLOC_SLAB_BLOCKS(pSlabs), pSlabs->pEnd, FALSE);
+        free(pSlabs->pMemory);
+        pSlabs = pNext;
+    }
+#else
+    (void)self;
+    (void)pSlabs;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_GetBatch
+//----------------------------------------------------------------------------
+static UINT32 ALLOC_GetBatch(ALLOC_Allocator* self, UINT32 count, void* blocks[])
+{
+    UINT32 got = 0;
+    UINT32 start;
+
+    do
+    {
+        start = got;
+
+        ALLOC_LOCK(self);
+
+        // Take the blocks from the free-list, pool or overflow slabs
+        while (got < count)
+        {
+            void* pBlock = ALLOC_Get(self);
+            if (!pBlock)
+                break;
+            blocks[got++] = GET_CLIENT_PTR(pBlock);
+        }
+
+        // Keep track of usage statistics
+        self->allocations += got - start;
+        self->blocksInUse += (INT32)(got - start);
+        if (self->blocksInUse > (INT32)self->maxBlocksInUse)
+        {
+            self->maxBlocksInUse = (UINT32)self->blocksInUse;
+        }
+
+        ALLOC_UNLOCK(self);
+
+    // Add an overflow slab if the blocks ran out
+    } while (got < count && ALLOC_Grow(self));
+
+    return got;
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_PutBatch
+//----------------------------------------------------------------------------
+static void ALLOC_PutBatch(ALLOC_Allocator* self, UINT32 count, void* const blocks[])
+{
+    struct ALLOC_Slab* pRelease = NULL;
+    UINT32 idx;
+
+    if (count == 0)
+        return;
+
+    ALLOC_LOCK(self);
+
+    // Return the blocks to the free-list or their overflow slabs
+    for (idx = 0; idx < count; idx++)
+        ALLOC_Put(self, GET_BLOCK_PTR(blocks[idx]), &pRelease);
+
+    // Keep track of usage statistics
+    self->deallocations += count;
+    self->blocksInUse -= (INT32)count;
+
+    ALLOC_UNLOCK(self);
+
+    ALLOC_ReleaseSlabs(self, pRelease);
+}
+
+#ifdef USE_ALLOC_MAGAZINES
+//----------------------------------------------------------------------------
+// ALLOC_GetMagazine
+//----------------------------------------------------------------------------
+static ALLOC_Magazine* ALLOC_GetMagazine(ALLOC_Allocator* self)
+{
+    UINT32 id = ATOMIC_Load32(&self->magazineId);
+
+    // Assign a magazine index on first use
+    if (id == 0)
+    {
+        ALLOC_LOCK(self);
+        if (self->magazineId == 0)
+        {
+            id = ALLOC_NO_MAGAZINE;
+            if (self->maxBlocks >= ALLOC_MAGAZINE_MIN_BLOCKS)
+            {
+                UINT32 next = ATOMIC_Add32(&_magazineCount, 1);
+                if (next <= ALLOC_MAX_MAGAZINES)
+                {
+                    _magazineOwners[next - 1] = self;
+                    id = next;
+                }
+            }
+            ATOMIC_Store32(&self->magazineId, id);
+        }
+        id = self->magazineId;
+        ALLOC_UNLOCK(self);
+    }
+
+    return (id == ALLOC_NO_MAGAZINE) ? NULL : &_magazines[id - 1];
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_FlushStats
+//----------------------------------------------------------------------------
+static void ALLOC_FlushStats(ALLOC_Allocator* self, ALLOC_Magazine* mag)
+{
+    // Blocks the thread handed out from its magazine, less those it took 
+    // back, moved from the cache to the clients. Another thread may free 
+    // blocks this thread allocated before this thread's counts are added, 
+    // so blocksInUse can briefly read below zero.
+    INT32 net = (INT32)(mag->allocations - mag->deallocations);
+
+    // The thread's own peak, on top of the other threads' last known use
+    if (self->blocksInUse + mag->maxHeld > (INT32)self->maxBlocksInUse)
+    {
+        self->maxBlocksInUse = (UINT32)(self->blocksInUse + mag->maxHeld);
+    }
+
+    self->allocations += mag->allocations;
+    self->deallocations += mag->deallocations;
+    self->blocksInUse += net;
+    self->cachedBlocks -= (UINT32)net;
+    mag->allocations = 0;
+    mag->deallocations = 0;
+    mag->maxHeld = 0;
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_TrackHeld
+//----------------------------------------------------------------------------
+static void ALLOC_TrackHeld(ALLOC_Magazine* mag)
+{
+    INT32 held = (INT32)(mag->allocations - mag->deallocations);
+
+    if (held > mag->maxHeld)
+        mag->maxHeld = held;
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_Refill
+//----------------------------------------------------------------------------
+static void ALLOC_Refill(ALLOC_Allocator* self, ALLOC_Magazine* mag)
+{
+    UINT32 start = mag->count;
+
+    do
+    {
+        ALLOC_LOCK(self);
+
+        // Take a batch of blocks from the free-list, pool or overflow slabs
+        while (mag->count < ALLOC_MAGAZINE_BATCH)
+        {
+            void* pBlock = ALLOC_Get(self);
+            if (!pBlock)
+                break;
+            mag->blocks[mag->count++] = pBlock;
+        }
+
+        // Cached blocks are not in use until the thread hands them out
+        self->cachedBlocks += mag->count - start;
+        ALLOC_FlushStats(self, mag);
+
+        ALLOC_UNLOCK(self);
+
+        start = mag->count;
+
+    // Add an overflow slab if no block was available
+    } while (mag->count == 0 && ALLOC_Grow(self));
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_Drain
+//----------------------------------------------------------------------------
+static void ALLOC_Drain(ALLOC_Allocator* self, ALLOC_Magazine* mag, UINT32 count)
+{
+    struct ALLOC_Slab* pRelease = NULL;
+    UINT32 idx;
+
+    ASSERT_TRUE(count <= mag->count);
+
+    ALLOC_LOCK(self);
+
+    // Return the top blocks of the magazine to the free-list or their slabs
+    mag->count -= count;
+    for (idx = mag->count; idx < mag->count + count; idx++)
+        ALLOC_Put(self, mag->blocks[idx], &pRelease);
+    ALLOC_FlushStats(self, mag);
+    self->cachedBlocks -= count;
+
+    ALLOC_UNLOCK(self);
+
+    ALLOC_ReleaseSlabs(self, pRelease);
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_FlushThreadCache
+//----------------------------------------------------------------------------
+void ALLOC_FlushThreadCache(void)
+{
+    UINT32 count = ATOMIC_Load32(&_magazineCount);
+    UINT32 idx;
+
+    if (count > ALLOC_MAX_MAGAZINES)
+        count = ALLOC_MAX_MAGAZINES;
+
+    for (idx = 0; idx < count; idx++)
+    {
+        ALLOC_Magazine* mag = &_magazines[idx];
+        if (mag->count || mag->allocations || mag->deallocations)
+            ALLOC_Drain(_magazineOwners[idx], mag, mag->count);
+    }
+}
+#else
+//----------------------------------------------------------------------------
+// ALLOC_FlushThreadCache
+//----------------------------------------------------------------------------
+void ALLOC_FlushThreadCache(void)
+{
+}
+#endif
+
+//----------------------------------------------------------------------------
+// ALLOC_Failed
+//----------------------------------------------------------------------------
+static void ALLOC_Failed(ALLOC_Allocator* self)
+{
+    ALLOC_LOCK(self);
+    self->failures++;
+    ALLOC_UNLOCK(self);
+
+    // Out of fixed block memory
+    ASSERT();
+}
+
 //----------------------------------------------------------------------------
 // ALLOC_Init
 //----------------------------------------------------------------------------
 void ALLOC_Init()
 {
-    _hLock = LK_CREATE();
+    // Allocator locks are statically initialized
 } 
 
 //----------------------------------------------------------------------------
@@ -116,7 +598,6 @@ void ALLOC_Init()
 //----------------------------------------------------------------------------
 void ALLOC_Term()
 {
-    LK_DESTROY(_hLock);
 }
 
 //----------------------------------------------------------------------------
@@ -135,26 +616,58 @@ void* ALLOC_Alloc(ALLOC_HANDLE hAlloc, size_t size)
     // Ensure requested size fits within memory block 
     ASSERT_TRUE(size <= self->blockSize);
 
-    // Get a block from the free-list
-    pBlock = ALLOC_Pop(self);
+    // Add the allocator to the registry on first use
+    if (!self->registered)
+        ALLOC_Register(self);
 
-    // If the free-list empty?
-    if (!pBlock)
+#ifdef USE_ALLOC_MAGAZINES
     {
-        // Get a new block from the pool
-        pBlock = ALLOC_NewBlock(self);
+        ALLOC_Magazine* mag = ALLOC_GetMagazine(self);
+        if (mag)
+        {
+            // Refill an empty magazine from the shared free-list
+            if (mag->count == 0)
+                ALLOC_Refill(self, mag);
+
+            if (mag->count == 0)
+            {
+                ALLOC_Failed(self);
+                return NULL;
+            }
+
+            mag->allocations++;
+            ALLOC_TrackHeld(mag);
+            pBlock = mag->blocks[--mag->count];
+            return GET_CLIENT_PTR(pBlock);
+        }
     }
+#endif
 
-    if (pBlock)
+    do
     {
-        // Keep track of usage statistics
-        self->allocations++;
-        self->blocksInUse++;
-        if (self->blocksInUse > self->maxBlocksInUse)
+        ALLOC_LOCK(self);
+
+        // Get a block from the free-list, pool or an overflow slab
+        pBlock = ALLOC_Get(self);
+
+        if (pBlock)
         {
-            self->maxBlocksInUse = self->blocksInUse;
+            // Keep track of usage statistics
+            self->allocations++;
+            self->blocksInUse++;
+            if (self->blocksInUse > (INT32)self->maxBlocksInUse)
+            {
+                self->maxBlocksInUse = (UINT32)self->blocksInUse;
+            }
         }
-    }
+
+        ALLOC_UNLOCK(self);
+
+    // Add an overflow slab if no block was available
+    } while (!pBlock && ALLOC_Grow(self));
+
+    if (!pBlock)
+        ALLOC_Failed(self);
 
     return GET_CLIENT_PTR(pBlock);
 } 
@@ -190,6 +703,7 @@ void* ALLOC_Calloc(ALLOC_HANDLE hAlloc, size_t num, size_t size)
 void ALLOC_Free(ALLOC_HANDLE hAlloc, void* pBlock)
 {
     ALLOC_Allocator* self = NULL;
+    struct ALLOC_Slab* pRelease = NULL;
 
     if (!pBlock)
         return;
@@ -202,13 +716,249 @@ void ALLOC_Free(ALLOC_HANDLE hAlloc, void* pBlock)
     // Get a pointer to the block
     pBlock = GET_BLOCK_PTR(pBlock);
 
-    // Push the block onto a stack (i.e. the free-list)
-    ALLOC_Push(self, pBlock);
+#ifdef USE_ALLOC_MAGAZINES
+    {
+        ALLOC_Magazine* mag = ALLOC_GetMagazine(self);
+        if (mag)
+        {
+            // Return half of a full magazine to the shared free-list
+            if (mag->count == ALLOC_MAGAZINE_SIZE)
+                ALLOC_Drain(self, mag, ALLOC_MAGAZINE_BATCH);
+
+            mag->deallocations++;
+            mag->blocks[mag->count++] = pBlock;
+            return;
+        }
+    }
+#endif
+
+    ALLOC_LOCK(self);
+
+    // Return the block to the free-list or its overflow slab
+    ALLOC_Put(self, pBlock, &pRelease);
 
     // Keep track of usage statistics
     self->deallocations++;
     self->blocksInUse--;
+
+    ALLOC_UNLOCK(self);
+
+    ALLOC_ReleaseSlabs(self, pRelease);
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_AllocBatch
+//----------------------------------------------------------------------------
+BOOL ALLOC_AllocBatch(ALLOC_HANDLE hAlloc, UINT32 count, void* blocks[])
+{
+    ALLOC_Allocator* self = NULL;
+    UINT32 got = 0;
+
+    ASSERT_TRUE(hAlloc);
+    ASSERT_TRUE(blocks || count == 0);
+
+    // Convert handle to an ALLOC_Allocator instance
+    self = (ALLOC_Allocator*)hAlloc;
+
+    // Add the allocator to the registry on first use
+    if (!self->registered)
+        ALLOC_Register(self);
+
+#ifdef USE_ALLOC_MAGAZINES
+    {
+        // Take what the thread's magazine holds first
+        ALLOC_Magazine* mag = ALLOC_GetMagazine(self);
+        if (mag)
+        {
+            while (got < count && mag->count)
+            {
+                void* pBlock = mag->blocks[--mag->count];
+                blocks[got++] = GET_CLIENT_PTR(pBlock);
+            }
+            mag->allocations += got;
+            ALLOC_TrackHeld(mag);
+        }
+    }
+#endif
+
+    // Take the remainder from the shared free-list under one lock
+    if (got < count)
+        got += ALLOC_GetBatch(self, count - got, &blocks[got]);
+
+    if (got < count)
+    {
+        // Return the partial batch and fail the whole request
+        ALLOC_FreeBatch(self, got, blocks);
+        ALLOC_Failed(self);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_FreeBatch
+//----------------------------------------------------------------------------
+void ALLOC_FreeBatch(ALLOC_HANDLE hAlloc, UINT32 count, void* const blocks[])
+{
+    ALLOC_Allocator* self = NULL;
+    UINT32 idx = 0;
+
+    ASSERT_TRUE(hAlloc);
+    ASSERT_TRUE(blocks || count == 0);
+
+    // Cast handle to an allocator instance
+    self = (ALLOC_Allocator*)hAlloc;
+
+#ifdef USE_ALLOC_MAGAZINES
+    {
+        // Fill the thread's magazine first
+        ALLOC_Magazine* mag = ALLOC_GetMagazine(self);
+        if (mag)
+        {
+            while (idx < count && mag->count < ALLOC_MAGAZINE_SIZE)
+                mag->blocks[mag->count++] = GET_BLOCK_PTR(blocks[idx++]);
+            mag->deallocations += idx;
+        }
+    }
+#endif
+
+    // Return the remainder to the shared free-list under one lock
+    ALLOC_PutBatch(self, count - idx, &blocks[idx]);
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_SetSlabObserver
+//----------------------------------------------------------------------------
+void ALLOC_SetSlabObserver(ALLOC_SlabObserverFuncType observerFunc)
+{
+#ifdef USE_ALLOC_OVERFLOW
+    _slabObserver = observerFunc;
+#else
+    (void)observerFunc;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_OwnsBlock
+//----------------------------------------------------------------------------
+BOOL ALLOC_OwnsBlock(ALLOC_HANDLE hAlloc, const void* pBlock)
+{
+    ALLOC_Allocator* self = NULL;
+    BOOL owns = FALSE;
+
+    ASSERT_TRUE(hAlloc);
+
+    // Cast handle to an allocator instance
+    self = (ALLOC_Allocator*)hAlloc;
+
+    if (ALLOC_IN_POOL(self, pBlock))
+        return TRUE;
+
+#ifdef USE_ALLOC_OVERFLOW
+    {
+        ALLOC_Slab* pSlab;
+
+        ALLOC_LOCK(self);
+        for (pSlab = self->pSlabs; pSlab && !owns; pSlab = pSlab->pNext)
+        {
+            owns = ((const char*)pBlock >= ALLOC_SLAB_BLOCKS(pSlab) && 
+                    (const char*)pBlock < pSlab->pEnd);
+        }
+        ALLOC_UNLOCK(self);
+    }
+#endif
+
+    return owns;
 } 
 
+//----------------------------------------------------------------------------
+// ALLOC_Register
+//----------------------------------------------------------------------------
+void ALLOC_Register(ALLOC_HANDLE hAlloc)
+{
+    ALLOC_Allocator* self = NULL;
+    UINT64 now;
+
+    ASSERT_TRUE(hAlloc);
+
+    // Cast handle to an allocator instance
+    self = (ALLOC_Allocator*)hAlloc;
+
+    now = CLK_GetTimeNs();
+
+    SPIN_Lock(&_registryLock);
+    if (!self->registered)
+    {
+        ALLOC_LOCK(self);
+        self->rateTimeNs = now;
+        self->rateAllocations = self->allocations;
+        ALLOC_UNLOCK(self);
+
+        // Link the allocator before publishing the new list head
+        self->pNextRegistered = _registry;
+        ATOMIC_StorePtr(&_registry, self);
+        ATOMIC_Store32(&self->registered, TRUE);
+    }
+    SPIN_Unlock(&_registryLock);
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_GetStats
+//----------------------------------------------------------------------------
+void ALLOC_GetStats(ALLOC_HANDLE hAlloc, ALLOC_Stats* stats)
+{
+    ALLOC_Allocator* self = NULL;
+    UINT64 now;
 
+    ASSERT_TRUE(hAlloc);
+    ASSERT_TRUE(stats);
 
+    // Cast handle to an allocator instance
+    self = (ALLOC_Allocator*)hAlloc;
+
+    now = CLK_GetTimeNs();
+
+    // Copy the counters under the lock so they are consistent with each other
+    ALLOC_LOCK(self);
+    stats->name = self->name;
+    stats->blockSize = self->blockSize;
+    stats->maxBlocks = self->maxBlocks;
+    stats->blocksInUse = (self->blocksInUse > 0) ? (UINT32)self->blocksInUse : 0;
+    stats->maxBlocksInUse = self->maxBlocksInUse;
+    stats->cachedBlocks = self->cachedBlocks;
+    stats->allocations = self->allocations;
+    stats->deallocations = self->deallocations;
+    stats->failures = self->failures;
+    stats->overflowAllocations = self->overflowAllocations;
+    stats->slabCount = self->slabCount;
+    stats->maxSlabCount = self->maxSlabCount;
+
+    // Allocation rate since the previous sample
+    stats->allocationsPerSec = 0;
+    if (self->rateTimeNs && now > self->rateTimeNs)
+    {
+        stats->allocationsPerSec = (UINT64)((double)(self->allocations - self->rateAllocations) * 1e9 / 
+            (double)(now - self->rateTimeNs));
+    }
+    self->rateTimeNs = now;
+    self->rateAllocations = self->allocations;
+    ALLOC_UNLOCK(self);
+}
+
+//----------------------------------------------------------------------------
+// ALLOC_IterateStats
+//----------------------------------------------------------------------------
+void ALLOC_IterateStats(ALLOC_StatsFuncType statsFunc, void* userData)
+{
+    ALLOC_Allocator* pAlloc;
+    ALLOC_Stats stats;
+
+    ASSERT_TRUE(statsFunc);
+
+    for (pAlloc = (ALLOC_Allocator*)ATOMIC_LoadPtr(&_registry); pAlloc; pAlloc = pAlloc->pNextRegistered)
+    {
+        ALLOC_GetStats(pAlloc, &stats);
+        statsFunc(&stats, userData);
+    }
+}
@@ -18,12 +18,29 @@
 //      block = ALLOC_Alloc(myAllocator, 32);
 //      ALLOC_Free(myAllocator, block);
 // }
+//
+// With USE_ALLOC_MAGAZINES defined, each thread keeps a small cache of free
+// blocks (a magazine) per allocator and exchanges blocks with the shared 
+// free list in batches. Allocation and free on a thread with a non-empty,
+// non-full magazine take no lock. Only allocators with at least 
+// ALLOC_MAGAZINE_MIN_BLOCKS blocks use magazines, since every thread may 
+// hold up to ALLOC_MAGAZINE_SIZE blocks of each. A thread that allocates 
+// should call ALLOC_FlushThreadCache() before it exits. Blocks in a 
+// magazine are not counted as in use. A thread's allocations and frees are
+// added to the statistics when its magazine exchanges blocks with the 
+// shared free list or is flushed.
+//
+// With USE_ALLOC_OVERFLOW defined, an allocator whose static pool is 
+// exhausted chains overflow slabs allocated from the heap instead of 
+// asserting. The static pool can then be sized for typical load and stay
+// small, while a burst costs an occasional slab allocation.
 
 #ifndef _FB_ALLOCATOR_H
 #define _FB_ALLOCATOR_H
 
 #include <stdlib.h>
 #include "DataTypes.h"
+#include "SpinLock.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,25 +53,103 @@ typedef struct
     void* pNext;
 } ALLOC_Block;
 
+struct ALLOC_Slab;
+
 // Use ALLOC_DEFINE to declare an ALLOC_Allocator object
-typedef struct
+typedef struct ALLOC_Allocator
 {
     const char* name;
     const char* pPool;
     const size_t objectSize;
     const size_t blockSize;
     const UINT32 maxBlocks;
+    SPIN_LOCK lock;             // Guards the fields below
+    UINT32 magazineId;          // Thread cache index + 1. 0 if unassigned.
     ALLOC_Block* pHead;
-    UINT16 poolIndex;
-    UINT16 blocksInUse;
-    UINT16 maxBlocksInUse;
-    UINT16 allocations;
-    UINT16 deallocations;
+    UINT32 poolIndex;
+    INT32 blocksInUse;          // Held by clients, including overflow blocks
+    UINT32 maxBlocksInUse;
+    UINT32 cachedBlocks;        // Free blocks held in thread magazines
+    UINT64 allocations;
+    UINT64 deallocations;
+    UINT64 failures;            // Allocations that found no free block
+    struct ALLOC_Slab* pSlabs;  // Overflow slabs, newest first
+    UINT32 slabCount;
+    UINT32 spareSlabs;          // Slabs with no blocks in use
+    UINT32 maxSlabCount;
+    UINT64 overflowAllocations; // Allocations served by an overflow slab
+    UINT32 slabReleases;        // Empty slabs returned to the heap
+    UINT64 rateTimeNs;          // Time of the last allocation rate sample
+    UINT64 rateAllocations;     // Allocations at the last rate sample
+    volatile UINT32 registered; // Added to the allocator registry
+    struct ALLOC_Allocator* pNextRegistered;
 } ALLOC_Allocator;
 
+// A snapshot of an allocator's statistics
+typedef struct
+{
+    const char* name;
+    size_t blockSize;
+    UINT32 maxBlocks;           // Blocks in the static pool
+    UINT32 blocksInUse;
+    UINT32 maxBlocksInUse;      // High watermark of blocks held by clients
+    UINT32 cachedBlocks;        // Free blocks held in thread magazines
+    UINT64 allocations;
+    UINT64 deallocations;
+    UINT64 failures;
+    UINT64 overflowAllocations;
+    UINT32 slabCount;
+    UINT32 maxSlabCount;
+    UINT64 allocationsPerSec;   // Since the previous ALLOC_GetStats() call
+} ALLOC_Stats;
+
+// Called by ALLOC_IterateStats() for each registered allocator
+typedef void (*ALLOC_StatsFuncType)(const ALLOC_Stats* stats, void* userData);
+
 // Align fixed blocks on X-byte boundary based on CPU architecture.
-// Set value to 1, 2, 4 or 8.
-#define ALLOC_MEM_ALIGN   (1)
+// Set value to 1, 2, 4 or 8. Used by ALLOC_DEFINE; see ALLOC_DEFINE_ALIGNED
+// to choose the alignment of one allocator.
+#define ALLOC_MEM_ALIGN         8
+
+// Cache line size of the target CPU in bytes
+#define ALLOC_CACHE_LINE_SIZE   64
+
+// Align a static variable on an _align_ byte boundary. _align_ must be a 
+// literal power of two.
+#if defined(_MSC_VER)
+    #define ALLOC_ALIGNAS(_align_)  __declspec(align(_align_))
+#else
+    #define ALLOC_ALIGNAS(_align_)  __attribute__((aligned(_align_)))
+#endif
+
+// Define USE_ALLOC_MAGAZINES to cache free blocks per thread
+#define USE_ALLOC_MAGAZINES
+
+// Blocks a thread caches per allocator. Half are exchanged with the shared
+// free list at a time.
+#define ALLOC_MAGAZINE_SIZE         16
+
+// Smallest allocator that uses thread caches
+#define ALLOC_MAGAZINE_MIN_BLOCKS   256
+
+// Maximum number of allocators that use thread caches
+#define ALLOC_MAX_MAGAZINES         32
+
+// Define USE_ALLOC_OVERFLOW to allocate overflow slabs from the heap when a
+// static pool is exhausted. Each slab holds as many blocks as the static 
+// pool, and at least ALLOC_OVERFLOW_MIN_BLOCKS.
+#define USE_ALLOC_OVERFLOW
+
+#define ALLOC_OVERFLOW_MIN_BLOCKS   16
+
+// Maximum number of overflow slabs per allocator
+#define ALLOC_OVERFLOW_MAX_SLABS    64
+
+// Define ALLOC_OVERFLOW_RELEASE to return empty slabs to the heap. Up to
+// ALLOC_OVERFLOW_SPARE_SLABS empty slabs are kept for the next burst.
+#define ALLOC_OVERFLOW_RELEASE
+
+#define ALLOC_OVERFLOW_SPARE_SLABS  1
 
 // Get the maximum between a or b
 #define ALLOC_MAX(a,b) (((a)>(b))?(a):(b))
@@ -66,7 +161,11 @@ typedef struct
 // Ensure the memory block size is: (a) is aligned on desired boundary and (b) at
 // least the size of a ALLOC_Allocator*. 
 #define ALLOC_BLOCK_SIZE(_size_) \
-    (ALLOC_MAX((ALLOC_ROUND_UP(_size_, ALLOC_MEM_ALIGN)), sizeof(ALLOC_Allocator*)))
+    ALLOC_BLOCK_SIZE_ALIGNED(_size_, ALLOC_MEM_ALIGN)
+
+// Block size rounded up to a multiple of _align_ bytes
+#define ALLOC_BLOCK_SIZE_ALIGNED(_size_, _align_) \
+    (ALLOC_MAX((ALLOC_ROUND_UP((_size_), (_align_))), sizeof(ALLOC_Allocator*)))
 
 // Defines block memory, allocator instance and a handle. On the example below, 
 // the ALLOC_Allocator instance is myAllocatorObj and the handle is myAllocator.
@@ -75,17 +174,69 @@ typedef struct
 // _objects_ - number of fixed memory blocks 
 // e.g. ALLOC_DEFINE(myAllocator, 32, 10)
 #define ALLOC_DEFINE(_name_, _size_, _objects_) \
-    static char _name_##Memory[ALLOC_BLOCK_SIZE(_size_) * (_objects_)] = { 0 }; \
-    static ALLOC_Allocator _name_##Obj = { #_name_, _name_##Memory, _size_, \
-        ALLOC_BLOCK_SIZE(_size_), _objects_, NULL, 0, 0, 0, 0, 0 }; \
+    ALLOC_DEFINE_ALIGNED(_name_, _size_, _objects_, ALLOC_MEM_ALIGN)
+
+// Same as ALLOC_DEFINE, with each block aligned on an _align_ byte boundary
+// and padded to a multiple of _align_ bytes. _align_ must be a literal 
+// power of two, e.g. 16 for aligned SIMD loads. An _align_ of 
+// ALLOC_CACHE_LINE_SIZE gives each block whole cache lines of its own, so 
+// blocks used by different threads never share a line.
+// e.g. ALLOC_DEFINE_ALIGNED(myAllocator, 24, 10, 16)
+#define ALLOC_DEFINE_ALIGNED(_name_, _size_, _objects_, _align_) \
+    static ALLOC_ALIGNAS(_align_) char _name_##Memory[ALLOC_BLOCK_SIZE_ALIGNED(_size_, _align_) * (_objects_)] = { 0 }; \
+    static ALLOC_ALIGNAS(ALLOC_CACHE_LINE_SIZE) ALLOC_Allocator _name_##Obj = { #_name_, _name_##Memory, _size_, \
+        ALLOC_BLOCK_SIZE_ALIGNED(_size_, _align_), _objects_, SPIN_LOCK_INIT, 0, NULL, 0, 0, 0, 0, 0, 0, 0, \
+        NULL, 0, 0, 0, 0, 0, 0, 0, 0, NULL }; \
     static ALLOC_HANDLE _name_ = &_name_##Obj;
 
+// Define a cache line aligned and padded allocator
+#define ALLOC_DEFINE_CACHE_ALIGNED(_name_, _size_, _objects_) \
+    ALLOC_DEFINE_ALIGNED(_name_, _size_, _objects_, ALLOC_CACHE_LINE_SIZE)
+
 void ALLOC_Init(void);
 void ALLOC_Term(void);
 void* ALLOC_Alloc(ALLOC_HANDLE hAlloc, size_t size);
 void* ALLOC_Calloc(ALLOC_HANDLE hAlloc, size_t num, size_t size);
 void ALLOC_Free(ALLOC_HANDLE hAlloc, void* pBlock);
 
+// Allocate count blocks into the blocks array, taking the allocator lock 
+// once for the batch. Either every block is allocated and TRUE returned, or
+// none and FALSE.
+BOOL ALLOC_AllocBatch(ALLOC_HANDLE hAlloc, UINT32 count, void* blocks[]);
+
+// Free count blocks of one allocator, taking the allocator lock once
+void ALLOC_FreeBatch(ALLOC_HANDLE hAlloc, UINT32 count, void* const blocks[]);
+
+// Return the calling thread's cached blocks to their allocators
+void ALLOC_FlushThreadCache(void);
+
+// Return TRUE if pBlock is a block of the allocator's static pool or 
+// overflow slabs
+BOOL ALLOC_OwnsBlock(ALLOC_HANDLE hAlloc, const void* pBlock);
+
+// Called when an overflow slab is added to or released from an allocator.
+// pStart and pEnd bound the slab's blocks. A slab is added before any of 
+// its blocks is allocated and released after all are freed. Never called
+// with the allocator lock held.
+typedef void (*ALLOC_SlabObserverFuncType)(ALLOC_Allocator* alloc, const char* pStart, 
+    const char* pEnd, BOOL added);
+
+// Set the function told of each overflow slab added or released. Slabs 
+// added before it is set are not reported. x_allocator sets it to find the
+// owner of overflow blocks by address.
+void ALLOC_SetSlabObserver(ALLOC_SlabObserverFuncType observerFunc);
+
+// Add an allocator to the registry reported by ALLOC_IterateStats(). An 
+// allocator registers itself on first use; call to report it before then.
+void ALLOC_Register(ALLOC_HANDLE hAlloc);
+
+// Get a snapshot of an allocator's statistics. Counts held by thread caches
+// are reported once the cache exchanges a batch with the allocator.
+void ALLOC_GetStats(ALLOC_HANDLE hAlloc, ALLOC_Stats* stats);
+
+// Call statsFunc with the statistics of every registered allocator
+void ALLOC_IterateStats(ALLOC_StatsFuncType statsFunc, void* userData);
+
 #ifdef __cplusplus
 }
 #endif
@@ -2,17 +2,340 @@
 #include "fb_allocator.h"
 #include "DataTypes.h"
 #include "Fault.h"
+#include "Atomic.h"
 #include <string.h>
 
+// XAllocData::lookupState values
+#define XALLOC_LOOKUP_EMPTY     0   // Table not built yet
+#define XALLOC_LOOKUP_BUILDING  1   // A thread is building the table
+#define XALLOC_LOOKUP_READY     2   // Table built
+#define XALLOC_LOOKUP_NONE      3   // Allocators cannot be looked up by table
+
+// Blocks XALLOC_FreeBatch() collects before freeing them to their allocator
+#define XALLOC_FREE_BATCH       16
+
+#ifdef USE_XALLOC_HEADERLESS
+#include "SpinLock.h"
+
+// The address range of an allocator's pool or of one of its overflow slabs
+typedef struct
+{
+    const char* pStart;
+    const char* pEnd;
+    ALLOC_Allocator* pAllocator;
+} XALLOC_Pool;
+
+// Pools and slabs sorted by start address. Readers search without a lock and
+// retry if _poolSeq changed (or was odd) while searching. Writers hold 
+// _poolLock and make _poolSeq odd while modifying the array.
+static XALLOC_Pool _pools[XALLOC_MAX_POOLS + XALLOC_MAX_SLABS];
+static UINT32 _poolCount;
+static UINT32 _staticPoolCount;
+static UINT32 _slabCount;
+static volatile UINT32 _poolSeq;
+static SPIN_LOCK _poolLock = SPIN_LOCK_INIT;
+
+static void XALLOC_AddPool(ALLOC_Allocator* allocator);
+static void XALLOC_InsertRange(UINT32 idx, const char* pStart, const char* pEnd, ALLOC_Allocator* allocator);
+static void XALLOC_SlabObserver(ALLOC_Allocator* allocator, const char* pStart, const char* pEnd, BOOL added);
+static ALLOC_Allocator* XALLOC_FindOwner(void* block);
+#endif
+
+#ifdef USE_XALLOC_PROFILE
+#include <stdio.h>
+
+// A live block recorded by the profiler
+typedef struct
+{
+    void* ptr;
+    XAllocData* owner;
+    UINT32 bucket;
+} XALLOC_ProfileEntry;
+
+// Live blocks in an open addressed hash table. Guarded by _profileLock.
+static XALLOC_ProfileEntry _profileLive[XALLOC_PROFILE_MAX_LIVE];
+static UINT32 _profileUntracked;
+static SPIN_LOCK _profileLock = SPIN_LOCK_INIT;
+
+// Get the hash table slot for a block address
+#define XALLOC_PROFILE_HASH(_ptr_) \
+    ((UINT32)(((size_t)(_ptr_) >> 3) * 2654435761u) & (XALLOC_PROFILE_MAX_LIVE - 1))
+
+static void XALLOC_ProfileAlloc(XAllocData* self, void* ptr, size_t size);
+static void XALLOC_ProfileFree(void* ptr);
+#endif
+
+static void XALLOC_BuildLookup(XAllocData* self);
 static void* XALLOC_PutAllocatorPtrInBlock(void* block, ALLOC_Allocator* allocator);
 static ALLOC_Allocator* XALLOC_GetAllocatorPtrFromBlock(void* block);
 static ALLOC_Allocator* XALLOC_GetAllocator(XAllocData* self, size_t size);
 
+#ifdef USE_XALLOC_HEADERLESS
+//----------------------------------------------------------------------------
+// XALLOC_InsertRange
+//----------------------------------------------------------------------------
+static void XALLOC_InsertRange(UINT32 idx, const char* pStart, const char* pEnd, ALLOC_Allocator* allocator)
+{
+    // _poolLock must be held
+    ATOMIC_Add32(&_poolSeq, 1);
+    ATOMIC_FenceRelease();
+
+    memmove(&_pools[idx + 1], &_pools[idx], (_poolCount - idx) * sizeof(XALLOC_Pool));
+    _pools[idx].pStart = pStart;
+    _pools[idx].pEnd = pEnd;
+    _pools[idx].pAllocator = allocator;
+    _poolCount++;
+
+    ATOMIC_Add32(&_poolSeq, 1);
+}
+
+//----------------------------------------------------------------------------
+// XALLOC_AddPool
+//----------------------------------------------------------------------------
+static void XALLOC_AddPool(ALLOC_Allocator* allocator)
+{
+    const char* pStart = allocator->pPool;
+    UINT32 idx;
+
+    SPIN_Lock(&_poolLock);
+
+    // Find the sorted position. An allocator shared by two XAllocData 
+    // instances is only added once.
+    for (idx = 0; idx < _poolCount && _pools[idx].pStart < pStart; idx++)
+        ;
+    if (idx == _poolCount || _pools[idx].pAllocator != allocator)
+    {
+        // Too many allocators to find by address?
+        ASSERT_TRUE(_staticPoolCount < XALLOC_MAX_POOLS);
+
+        XALLOC_InsertRange(idx, pStart, pStart + allocator->blockSize * allocator->maxBlocks, allocator);
+        _staticPoolCount++;
+    }
+
+    // Track the overflow slabs added from now on
+    ALLOC_SetSlabObserver(XALLOC_SlabObserver);
+
+    SPIN_Unlock(&_poolLock);
+}
+
+//----------------------------------------------------------------------------
+// XALLOC_SlabObserver
+//----------------------------------------------------------------------------
+static void XALLOC_SlabObserver(ALLOC_Allocator* allocator, const char* pStart, const char* pEnd, BOOL added)
+{
+    UINT32 idx;
+
+    SPIN_Lock(&_poolLock);
+
+    for (idx = 0; idx < _poolCount && _pools[idx].pStart < pStart; idx++)
+        ;
+
+    if (!added)
+    {
+        // Remove the slab's range if it was added
+        if (idx < _poolCount && _pools[idx].pStart == pStart)
+        {
+            ATOMIC_Add32(&_poolSeq, 1);
+            ATOMIC_FenceRelease();
+
+            memmove(&_pools[idx], &_pools[idx + 1], (_poolCount - idx - 1) * sizeof(XALLOC_Pool));
+            _poolCount--;
+            _slabCount--;
+
+            ATOMIC_Add32(&_poolSeq, 1);
+        }
+    }
+    else if (_slabCount < XALLOC_MAX_SLABS)
+    {
+        UINT32 pool;
+
+        // Only slabs of allocators with a registered pool are added. A 
+        // slab that does not fit is found by XALLOC_FindOwner()'s search.
+        for (pool = 0; pool < _poolCount; pool++)
+        {
+            if (_pools[pool].pAllocator == allocator && _pools[pool].pStart == allocator->pPool)
+            {
+                XALLOC_InsertRange(idx, pStart, pEnd, allocator);
+                _slabCount++;
+                break;
+            }
+        }
+    }
+
+    SPIN_Unlock(&_poolLock);
+}
+
+//----------------------------------------------------------------------------
+// XALLOC_FindOwner
+//----------------------------------------------------------------------------
+static ALLOC_Allocator* XALLOC_FindOwner(void* block)
+{
+    const char* pBlock = (const char*)block;
+    ALLOC_Allocator* pAllocator;
+    UINT32 seq, base, count, half;
+
+    for (;;)
+    {
+        seq = ATOMIC_Load32(&_poolSeq);
+        if ((seq & 1) == 0)
+        {
+            // Binary search for the last pool or slab starting at or before
+            // the block. The conditional move form avoids mispredicted branches.
+            pAllocator = NULL;
+            base = 0;
+            count = _poolCount;
+            if (count > 0)
+            {
+                while (count > 1)
+                {
+                    half = count / 2;
+                    base = (_pools[base + half].pStart <= pBlock) ? base + half : base;
+                    count -= half;
+                }
+                if (_pools[base].pStart <= pBlock && pBlock < _pools[base].pEnd)
+                    pAllocator = _pools[base].pAllocator;
+            }
+
+            // Done if no pool was added during the search
+            ATOMIC_FenceAcquire();
+            if (ATOMIC_Load32(&_poolSeq) == seq)
+                break;
+        }
+        ATOMIC_Pause();
+    }
+
+    // Not within a known pool or slab. The block is in a slab that did not 
+    // fit in _pools, or was added before its allocator was registered.
+    if (!pAllocator)
+    {
+        ALLOC_Allocator* allocators[XALLOC_MAX_POOLS];
+
+        SPIN_Lock(&_poolLock);
+        count = 0;
+        for (base = 0; base < _poolCount; base++)
+        {
+            if (_pools[base].pStart == _pools[base].pAllocator->pPool)
+                allocators[count++] = _pools[base].pAllocator;
+        }
+        SPIN_Unlock(&_poolLock);
+
+        // Search outside _poolLock so other frees are not held up
+        for (base = 0; base < count && !pAllocator; base++)
+        {
+            if (ALLOC_OwnsBlock(allocators[base], block))
+                pAllocator = allocators[base];
+        }
+    }
+
+    return pAllocator;
+}
+#endif
+
+#ifdef USE_XALLOC_PROFILE
+//----------------------------------------------------------------------------
+// XALLOC_ProfileAlloc
+//----------------------------------------------------------------------------
+static void XALLOC_ProfileAlloc(XAllocData* self, void* ptr, size_t size)
+{
+    XAllocProfileBucket* pBucket;
+    UINT32 bucket;
+    UINT32 idx;
+    UINT32 probes;
+
+    // Get the size range of the request
+    bucket = (size == 0) ? 0 : (UINT32)((size - 1) / XALLOC_PROFILE_GRANULE);
+    if (bucket >= XALLOC_PROFILE_BUCKETS)
+        bucket = XALLOC_PROFILE_BUCKETS - 1;
+    pBucket = &self->profile[bucket];
+
+    SPIN_Lock(&_profileLock);
+
+    pBucket->requests++;
+    if (size > self->profileMaxSize)
+        self->profileMaxSize = size;
+
+    // Remember the block's size range until it is freed
+    idx = XALLOC_PROFILE_HASH(ptr);
+    for (probes = 0; probes < XALLOC_PROFILE_MAX_LIVE; probes++)
+    {
+        if (!_profileLive[idx].ptr)
+        {
+            _profileLive[idx].ptr = ptr;
+            _profileLive[idx].owner = self;
+            _profileLive[idx].bucket = bucket;
+
+            if (++pBucket->live > pBucket->peak)
+                pBucket->peak = pBucket->live;
+            if (++self->profileLive > self->profilePeak)
+                self->profilePeak = self->profileLive;
+            break;
+        }
+        idx = (idx + 1) & (XALLOC_PROFILE_MAX_LIVE - 1);
+    }
+
+    // Too many live blocks to track?
+    if (probes == XALLOC_PROFILE_MAX_LIVE)
+        _profileUntracked++;
+
+    SPIN_Unlock(&_profileLock);
+}
+
+//----------------------------------------------------------------------------
+// XALLOC_ProfileFree
+//----------------------------------------------------------------------------
+static void XALLOC_ProfileFree(void* ptr)
+{
+    UINT32 idx, next, home;
+    UINT32 probes;
+
+    SPIN_Lock(&_profileLock);
+
+    // Find the block's entry
+    idx = XALLOC_PROFILE_HASH(ptr);
+    for (probes = 0; probes < XALLOC_PROFILE_MAX_LIVE && _profileLive[idx].ptr; probes++)
+    {
+        if (_profileLive[idx].ptr == ptr)
+        {
+            XAllocData* owner = _profileLive[idx].owner;
+            owner->profile[_profileLive[idx].bucket].live--;
+            owner->profileLive--;
+
+            // Remove the entry. Move each later entry of the probe run that
+            // cannot be found past the gap back into it.
+            next = idx;
+            for (;;)
+            {
+                next = (next + 1) & (XALLOC_PROFILE_MAX_LIVE - 1);
+                if (!_profileLive[next].ptr)
+                    break;
+                home = XALLOC_PROFILE_HASH(_profileLive[next].ptr);
+                if ((idx <= next) ? (idx < home && home <= next) : (idx < home || home <= next))
+                    continue;
+                _profileLive[idx] = _profileLive[next];
+                idx = next;
+            }
+            _profileLive[idx].ptr = NULL;
+            break;
+        }
+        idx = (idx + 1) & (XALLOC_PROFILE_MAX_LIVE - 1);
+    }
+
+    SPIN_Unlock(&_profileLock);
+}
+#endif
+
 //----------------------------------------------------------------------------
 // XALLOC_PutAllocatorPtrInBlock
 //----------------------------------------------------------------------------
 static void* XALLOC_PutAllocatorPtrInBlock(void* block, ALLOC_Allocator* allocator)
 {
+#ifdef USE_XALLOC_HEADERLESS
+    ASSERT_TRUE(block);
+    ASSERT_TRUE(allocator);
+
+    // The allocator is found by block address. The block is the client's memory.
+    return block;
+#else
     ALLOC_Allocator** pAllocatorInBlock;
 
     ASSERT_TRUE(block);
@@ -27,6 +350,7 @@ static void* XALLOC_PutAllocatorPtrInBlock(void* block, ALLOC_Allocator* allocat
     // Advance the pointer past the ALLOC_Allocator* and return a
     // pointer to the client's memory region
     return ++pAllocatorInBlock;
+#endif
 }
 
 //----------------------------------------------------------------------------
@@ -34,6 +358,17 @@ static void* XALLOC_PutAllocatorPtrInBlock(void* block, ALLOC_Allocator* allocat
 //----------------------------------------------------------------------------
 static ALLOC_Allocator* XALLOC_GetAllocatorPtrFromBlock(void* block)
 {
+#ifdef USE_XALLOC_HEADERLESS
+    ALLOC_Allocator* pAllocator;
+
+    ASSERT_TRUE(block);
+
+    // Find the allocator whose pool holds the block
+    pAllocator = XALLOC_FindOwner(block);
+    ASSERT_TRUE(pAllocator);
+
+    return pAllocator;
+#else
     ALLOC_Allocator** pAllocatorInBlock;
 
     ASSERT_TRUE(block);
@@ -46,6 +381,7 @@ static ALLOC_Allocator* XALLOC_GetAllocatorPtrFromBlock(void* block)
 
     // Return the allocator instance stored within the memory block
     return *pAllocatorInBlock;
+#endif
 }
 
 //----------------------------------------------------------------------------
@@ -53,6 +389,12 @@ static ALLOC_Allocator* XALLOC_GetAllocatorPtrFromBlock(void* block)
 //----------------------------------------------------------------------------
 static void* XALLOC_GetBlockPtr(void* block)
 {
+#ifdef USE_XALLOC_HEADERLESS
+    ASSERT_TRUE(block);
+
+    // No meta data precedes the client's memory
+    return block;
+#else
     ALLOC_Allocator** pAllocatorInBlock;
 
     ASSERT_TRUE(block);
@@ -62,6 +404,73 @@ static void* XALLOC_GetBlockPtr(void* block)
 
     // Back up one ALLOC_Allocator* position and return raw memory block pointer
     return --pAllocatorInBlock;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// XALLOC_BuildLookup
+//----------------------------------------------------------------------------
+static void XALLOC_BuildLookup(XAllocData* self)
+{
+    size_t sizeBits = 0;
+    size_t entries;
+    UINT32 shift = 0;
+    UINT32 entry;
+    UINT16 i = 0;
+
+    // Only one thread builds the table. Others wait until it is built.
+    if (!ATOMIC_CompareExchange32(&self->lookupState, XALLOC_LOOKUP_EMPTY, XALLOC_LOOKUP_BUILDING))
+        return;
+
+#ifdef USE_XALLOC_HEADERLESS
+    // Make each pool findable by address before its first block is allocated
+    for (i=0; i<self->maxAllocators; i++)
+    {
+        if (self->allocators[i])
+            XALLOC_AddPool(self->allocators[i]);
+    }
+#endif
+
+    // The table stores UINT8 indexes and requires every allocator
+    if (self->maxAllocators == 0 || self->maxAllocators > 255)
+    {
+        ATOMIC_Store32(&self->lookupState, XALLOC_LOOKUP_NONE);
+        return;
+    }
+    for (i=0; i<self->maxAllocators; i++)
+    {
+        if (!self->allocators[i])
+        {
+            ATOMIC_Store32(&self->lookupState, XALLOC_LOOKUP_NONE);
+            return;
+        }
+        sizeBits |= self->allocators[i]->blockSize;
+    }
+
+    // Each entry covers a range of sizes as wide as the largest power of two
+    // dividing every block size, so no range straddles two block sizes
+    while (!((sizeBits >> shift) & 1))
+        shift++;
+    entries = self->allocators[self->maxAllocators - 1]->blockSize >> shift;
+    if (entries > XALLOC_LOOKUP_SIZE)
+    {
+        ATOMIC_Store32(&self->lookupState, XALLOC_LOOKUP_NONE);
+        return;
+    }
+
+    // Entry N holds the first allocator able to hold sizes up to (N+1) << shift
+    i = 0;
+    for (entry=0; entry<entries; entry++)
+    {
+        size_t size = ((size_t)entry + 1) << shift;
+        while (self->allocators[i]->blockSize < size)
+            i++;
+        self->lookup[entry] = (UINT8)i;
+    }
+
+    self->lookupShift = shift;
+    self->lookupEntries = (UINT32)entries;
+    ATOMIC_Store32(&self->lookupState, XALLOC_LOOKUP_READY);
 }
 
 //----------------------------------------------------------------------------
@@ -70,6 +479,7 @@ static void* XALLOC_GetBlockPtr(void* block)
 static ALLOC_Allocator* XALLOC_GetAllocator(XAllocData* self, size_t size)
 {
     UINT16 i = 0;
+    UINT32 state;
     ALLOC_Allocator* pAllocator = NULL;
 
     ASSERT_TRUE(self);
@@ -78,6 +488,25 @@ static ALLOC_Allocator* XALLOC_GetAllocator(XAllocData* self, size_t size)
     // Add overhead for the additional memory required.
     size += XALLOC_BLOCK_META_DATA_SIZE;
 
+    state = ATOMIC_Load32(&self->lookupState);
+    while (state == XALLOC_LOOKUP_EMPTY || state == XALLOC_LOOKUP_BUILDING)
+    {
+        if (state == XALLOC_LOOKUP_EMPTY)
+            XALLOC_BuildLookup(self);
+        else
+            ATOMIC_Yield();
+        state = ATOMIC_Load32(&self->lookupState);
+    }
+
+    // Find the allocator using the lookup table
+    if (state == XALLOC_LOOKUP_READY)
+    {
+        size_t entry = (size > 0) ? (size - 1) >> self->lookupShift : 0;
+        if (entry >= self->lookupEntries)
+            return NULL;
+        return self->allocators[self->lookup[entry]];
+    }
+
     // Iterate over all allocators 
     for (i=0; i<self->maxAllocators; i++)
     {
@@ -116,6 +545,10 @@ void* XALLOC_Alloc(XAllocData* self, size_t size)
         {
             // Set the block ALLOC_Allocator* ptr within the raw memory block region
             pClientMemory = XALLOC_PutAllocatorPtrInBlock(pBlockMemory, pAllocator);
+
+#ifdef USE_XALLOC_PROFILE
+            XALLOC_ProfileAlloc(self, pClientMemory, size);
+#endif
         }
     }
     else
@@ -138,6 +571,10 @@ void XALLOC_Free(void* ptr)
     if (!ptr)
         return;
 
+#ifdef USE_XALLOC_PROFILE
+    XALLOC_ProfileFree(ptr);
+#endif
+
     // Extract the original allocator instance from the caller's block pointer
     pAllocator = XALLOC_GetAllocatorPtrFromBlock(ptr);
     if (pAllocator)
@@ -150,6 +587,83 @@ void XALLOC_Free(void* ptr)
     }
 } 
 
+//----------------------------------------------------------------------------
+// XALLOC_AllocBatch
+//----------------------------------------------------------------------------
+BOOL XALLOC_AllocBatch(XAllocData* self, size_t size, UINT32 count, void* ptrs[])
+{
+    ALLOC_Allocator* pAllocator;
+    UINT32 idx;
+
+    ASSERT_TRUE(self);
+
+    // Every block of the batch comes from the same allocator
+    pAllocator = XALLOC_GetAllocator(self, size);
+    if (!pAllocator)
+    {
+        // Too large a memory block requested
+        ASSERT();
+        return FALSE;
+    }
+
+    if (!ALLOC_AllocBatch(pAllocator, count, ptrs))
+        return FALSE;
+
+    for (idx = 0; idx < count; idx++)
+    {
+        // Convert each raw block into a client pointer
+        ptrs[idx] = XALLOC_PutAllocatorPtrInBlock(ptrs[idx], pAllocator);
+
+#ifdef USE_XALLOC_PROFILE
+        XALLOC_ProfileAlloc(self, ptrs[idx], size);
+#endif
+    }
+
+    return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// XALLOC_FreeBatch
+//----------------------------------------------------------------------------
+void XALLOC_FreeBatch(UINT32 count, void* const ptrs[])
+{
+    void* blocks[XALLOC_FREE_BATCH];
+    ALLOC_Allocator* pAllocator = NULL;
+    UINT32 blockCount = 0;
+    UINT32 idx;
+
+    ASSERT_TRUE(ptrs || count == 0);
+
+    for (idx = 0; idx < count; idx++)
+    {
+        ALLOC_Allocator* pOwner;
+
+        if (!ptrs[idx])
+            continue;
+
+#ifdef USE_XALLOC_PROFILE
+        XALLOC_ProfileFree(ptrs[idx]);
+#endif
+
+        pOwner = XALLOC_GetAllocatorPtrFromBlock(ptrs[idx]);
+        if (!pOwner)
+            continue;
+
+        // Free the collected run when the owner changes or the run is full
+        if (blockCount && (pOwner != pAllocator || blockCount == XALLOC_FREE_BATCH))
+        {
+            ALLOC_FreeBatch(pAllocator, blockCount, blocks);
+            blockCount = 0;
+        }
+
+        pAllocator = pOwner;
+        blocks[blockCount++] = XALLOC_GetBlockPtr(ptrs[idx]);
+    }
+
+    if (blockCount)
+        ALLOC_FreeBatch(pAllocator, blockCount, blocks);
+}
+
 //----------------------------------------------------------------------------
 // XALLOC_Realloc
 //----------------------------------------------------------------------------
@@ -167,19 +681,34 @@ void* XALLOC_Realloc(XAllocData* self, void *ptr, size_t new_size)
         XALLOC_Free(ptr);
     else
     {
+        // Get the original allocator instance from the old memory block
+        pOldAllocator = XALLOC_GetAllocatorPtrFromBlock(ptr);
+
+        // Keep the block if the new size uses the same allocator
+        if (XALLOC_GetAllocator(self, new_size) == pOldAllocator)
+        {
+#ifdef USE_XALLOC_PROFILE
+            XALLOC_ProfileFree(ptr);
+            XALLOC_ProfileAlloc(self, ptr, new_size);
+#endif
+            return ptr;
+        }
+
         // Create a new memory block
         pNewMem = XALLOC_Alloc(self, new_size);
         if (pNewMem != 0)
         {
-            // Get the original allocator instance from the old memory block
-            pOldAllocator = XALLOC_GetAllocatorPtrFromBlock(ptr);
             oldSize = pOldAllocator->blockSize - XALLOC_BLOCK_META_DATA_SIZE;
 
             // Copy the bytes from the old memory block into the new (as much as will fit)
             memcpy(pNewMem, ptr, (oldSize < new_size) ? oldSize : new_size);
 
-            // Free the old memory block
-            XALLOC_Free(ptr);
+#ifdef USE_XALLOC_PROFILE
+            XALLOC_ProfileFree(ptr);
+#endif
+
+            // Free the old memory block to its allocator
+            ALLOC_Free(pOldAllocator, XALLOC_GetBlockPtr(ptr));
         }
     }
 
@@ -212,5 +741,70 @@ void* XALLOC_Calloc(XAllocData* self, size_t num, size_t size)
     return pMem;
 } 
 
+//----------------------------------------------------------------------------
+// XALLOC_MaxBlockSize
+//----------------------------------------------------------------------------
+size_t XALLOC_MaxBlockSize(XAllocData* self)
+{
+    UINT16 i;
+
+    ASSERT_TRUE(self);
 
+    // The allocators are sorted, so the last one has the largest block
+    for (i = self->maxAllocators; i > 0; i--)
+    {
+        if (self->allocators[i - 1])
+            return self->allocators[i - 1]->blockSize - XALLOC_BLOCK_META_DATA_SIZE;
+    }
+    return 0;
+}
 
+//----------------------------------------------------------------------------
+// XALLOC_ProfileSave
+//----------------------------------------------------------------------------
+BOOL XALLOC_ProfileSave(XAllocData* self, const char* name, const char* fileName)
+{
+#ifdef USE_XALLOC_PROFILE
+    FILE* fp;
+    UINT32 bucket;
+
+    ASSERT_TRUE(self);
+    ASSERT_TRUE(name);
+    ASSERT_TRUE(fileName);
+
+    fp = fopen(fileName, "w");
+    if (!fp)
+        return FALSE;
+
+    SPIN_Lock(&_profileLock);
+
+    // Header lines, then one line per size range requested:
+    // bucket <largest size in range> <requests> <peak live blocks>
+    // The last range also holds every larger request, up to maxsize.
+    fprintf(fp, "# XALLOC profile\n");
+    fprintf(fp, "name %s\n", name);
+    fprintf(fp, "granule %d\n", XALLOC_PROFILE_GRANULE);
+    fprintf(fp, "metadata %d\n", (int)XALLOC_BLOCK_META_DATA_SIZE);
+    fprintf(fp, "peak %u\n", self->profilePeak);
+    fprintf(fp, "untracked %u\n", _profileUntracked);
+    fprintf(fp, "maxsize %llu\n", (unsigned long long)self->profileMaxSize);
+    for (bucket = 0; bucket < XALLOC_PROFILE_BUCKETS; bucket++)
+    {
+        if (self->profile[bucket].requests)
+        {
+            fprintf(fp, "bucket %u %llu %u\n", (bucket + 1) * XALLOC_PROFILE_GRANULE,
+                (unsigned long long)self->profile[bucket].requests, self->profile[bucket].peak);
+        }
+    }
+
+    SPIN_Unlock(&_profileLock);
+
+    fclose(fp);
+    return TRUE;
+#else
+    (void)self;
+    (void)name;
+    (void)fileName;
+    return FALSE;
+#endif
+}
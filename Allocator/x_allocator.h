@@ -30,7 +30,7 @@
 //
 // #define MAX_ALLOCATORS   (sizeof(allocators) / sizeof(allocators[0]))
 //
-// static XAllocData self = { allocators, MAX_ALLOCATORS };
+// static XAllocData self = XALLOC_DATA_INIT(allocators, MAX_ALLOCATORS);
 //
 // // Thin allocator wrapper function implementations call XALLOC
 // void* MYALLOC_Alloc(size_t size) { return XALLOC_Alloc(&self, size); }
@@ -44,6 +44,10 @@
 // void MYALLOC_Free(void* ptr);
 // void* MYALLOC_Realloc(void *ptr, size_t new_size);
 // void* MYALLOC_Calloc(size_t num, size_t size);
+//
+// On first use, each XAllocData builds a table mapping request sizes to 
+// allocators, so choosing the allocator costs one indexed load regardless
+// of the number of block sizes (see XALLOC_LOOKUP_SIZE).
 
 #ifndef _X_ALLOCATOR_H
 #define _X_ALLOCATOR_H
@@ -55,8 +59,65 @@
 extern "C" {
 #endif
 
+// Define USE_XALLOC_HEADERLESS to store no allocator pointer within each 
+// block. XALLOC_Free() then finds the owning allocator by the address range 
+// of its pool, so client blocks keep the pool's alignment and no RAM is 
+// spent on a per-block header. Blocks of overflow slabs (USE_ALLOC_OVERFLOW)
+// are found the same way, by the address range of their slab.
+#define USE_XALLOC_HEADERLESS
+
 // Overhead bytes added to each XALLOC memory block
+#ifdef USE_XALLOC_HEADERLESS
+#define XALLOC_BLOCK_META_DATA_SIZE  0
+#else
 #define XALLOC_BLOCK_META_DATA_SIZE  sizeof(ALLOC_Allocator*)
+#endif
+
+// Maximum number of allocators, across all XAllocData instances, whose
+// pools can be found by address
+#define XALLOC_MAX_POOLS    32
+
+// Maximum number of overflow slabs, across all XAllocData instances, found
+// by address. Blocks of further slabs are found by a slower search of each
+// allocator's slabs.
+#define XALLOC_MAX_SLABS    64
+
+// Number of size ranges in each XAllocData lookup table. The range width 
+// is the largest power of two that divides every block size, so each range
+// maps to exactly one allocator. An XAllocData whose largest block spans 
+// more ranges than this, or that has more than 255 allocators, chooses its
+// allocator with a linear search instead. Define before compiling to 
+// override.
+#ifndef XALLOC_LOOKUP_SIZE
+#define XALLOC_LOOKUP_SIZE  256
+#endif
+
+// Define USE_XALLOC_PROFILE to record, per XAllocData, a histogram of 
+// requested sizes with the peak number of live blocks of each size. 
+// XALLOC_ProfileSave() writes the histogram to a file that the PoolSizer
+// tool turns into a header of ALLOC_DEFINE statements sized for the run.
+// Recording takes a global lock on every allocation and free; use it in
+// profiling builds only.
+// #define USE_XALLOC_PROFILE
+
+// Request sizes are recorded in XALLOC_PROFILE_GRANULE byte ranges up to
+// XALLOC_PROFILE_MAX_SIZE. Larger requests are recorded in the last range,
+// and the largest request is saved so the tool can size a block for it.
+#define XALLOC_PROFILE_GRANULE      8
+#define XALLOC_PROFILE_MAX_SIZE     4096
+#define XALLOC_PROFILE_BUCKETS      (XALLOC_PROFILE_MAX_SIZE / XALLOC_PROFILE_GRANULE)
+
+// Maximum number of live blocks tracked across all XAllocData instances
+// while profiling. Must be a power of two.
+#define XALLOC_PROFILE_MAX_LIVE     4096
+
+// Recorded use of one range of request sizes
+typedef struct
+{
+    UINT64 requests;
+    UINT32 live;
+    UINT32 peak;
+} XAllocProfileBucket;
 
 typedef struct
 {
@@ -65,13 +126,54 @@ typedef struct
 
     // Number of allocator instances stored within the allocators array
     const UINT16 maxAllocators;
+
+    // Size to allocator lookup table. Built on first use; leave zeroed.
+    volatile UINT32 lookupState;
+    UINT32 lookupShift;
+    UINT32 lookupEntries;
+    UINT8 lookup[XALLOC_LOOKUP_SIZE];
+
+#ifdef USE_XALLOC_PROFILE
+    // Request size histogram. Leave zeroed.
+    XAllocProfileBucket profile[XALLOC_PROFILE_BUCKETS];
+    UINT32 profileLive;
+    UINT32 profilePeak;
+    size_t profileMaxSize;      // Largest request, e.g. in the last range
+#endif
 } XAllocData;
 
+// Initialize an XAllocData with its allocators array and every other field
+// zeroed, e.g. static XAllocData self = XALLOC_DATA_INIT(allocators, MAX_ALLOCATORS);
+#ifdef USE_XALLOC_PROFILE
+#define XALLOC_DATA_INIT(_allocators_, _maxAllocators_) \
+    { _allocators_, _maxAllocators_, 0, 0, 0, { 0 }, { { 0, 0, 0 } }, 0, 0, 0 }
+#else
+#define XALLOC_DATA_INIT(_allocators_, _maxAllocators_) \
+    { _allocators_, _maxAllocators_, 0, 0, 0, { 0 } }
+#endif
+
 void* XALLOC_Alloc(XAllocData* self, size_t size);
 void XALLOC_Free(void* ptr);
 void* XALLOC_Realloc(XAllocData* self, void *ptr, size_t new_size);
 void* XALLOC_Calloc(XAllocData* self, size_t num, size_t size);
 
+// Allocate count blocks of size bytes into the ptrs array with one lock 
+// acquisition. Either every block is allocated and TRUE returned, or none
+// and FALSE.
+BOOL XALLOC_AllocBatch(XAllocData* self, size_t size, UINT32 count, void* ptrs[]);
+
+// Free count blocks of any size and XAllocData. NULL entries are skipped.
+// Consecutive blocks of one allocator are freed with one lock acquisition.
+void XALLOC_FreeBatch(UINT32 count, void* const ptrs[]);
+
+// Get the largest size XALLOC_Alloc() can allocate from self
+size_t XALLOC_MaxBlockSize(XAllocData* self);
+
+// Write the recorded request size histogram to fileName under the given
+// name. Returns FALSE if USE_XALLOC_PROFILE is not defined or the file 
+// cannot be written.
+BOOL XALLOC_ProfileSave(XAllocData* self, const char* name, const char* fileName);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,107 @@
+// MsgBenchmark measures the callback messages per second a worker thread 
+// receives. Producer threads post pre-built CB_MSG_STATIC messages to 
+// Thread1 through DispatchCallbackThread1(), so the figure is the cost of
+// the queue, the wakeup and CB_TargetInvoke() alone.
+//
+// Usage:
+// MsgBenchmark [producers] [messages per producer]
+//
+// producers  number of producer threads (default 4)
+// messages   messages each producer posts (default 500000)
+
+#include "WorkerThreadStd.h"
+#include "Timer.h"
+#include "fb_allocator.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Messages each producer may have queued at once
+static const int SLOTS_PER_PRODUCER = 256;
+
+// A static message and a flag set while it is queued
+struct Slot
+{
+	CB_CallbackMsg msg;
+	atomic<bool> queued;
+};
+
+static atomic<long> received;
+
+//----------------------------------------------------------------------------
+// ReceiveCallback
+//----------------------------------------------------------------------------
+static void ReceiveCallback(const void* data, void* userData)
+{
+	(void)data;
+	received.fetch_add(1, memory_order_relaxed);
+	static_cast<Slot*>(userData)->queued.store(false, memory_order_release);
+}
+
+//----------------------------------------------------------------------------
+// main
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	int producers = (argc > 1) ? atoi(argv[1]) : 4;
+	long messages = (argc > 2) ? atol(argv[2]) : 500000;
+	if (producers < 1 || messages < 1)
+	{
+		fprintf(stderr, "Usage: MsgBenchmark [producers] [messages per producer]\n");
+		return 1;
+	}
+
+	ALLOC_Init();
+	TMR_Init();
+	CB_Init();
+	CreateThreads();
+
+	vector<Slot> slots(producers * SLOTS_PER_PRODUCER);
+	for (Slot& slot : slots)
+	{
+		slot.msg = CB_CallbackMsg();
+		slot.msg.cbFunc = ReceiveCallback;
+		slot.msg.cbUserData = &slot;
+		slot.msg.cbFlags = CB_MSG_STATIC;
+		slot.queued = false;
+	}
+
+	auto start = chrono::steady_clock::now();
+
+	vector<thread> threads;
+	for (int p = 0; p < producers; p++)
+	{
+		threads.emplace_back([&slots, p, messages]
+		{
+			for (long m = 0; m < messages; m++)
+			{
+				// A static message must not be posted again until it is received
+				Slot& slot = slots[p * SLOTS_PER_PRODUCER + m % SLOTS_PER_PRODUCER];
+				while (slot.queued.load(memory_order_acquire))
+					this_thread::yield();
+				slot.queued.store(true, memory_order_relaxed);
+				DispatchCallbackThread1(&slot.msg);
+			}
+		});
+	}
+	for (thread& t : threads)
+		t.join();
+
+	long total = producers * messages;
+	while (received.load() < total)
+		this_thread::yield();
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("%d producers, %ld messages: %.2f M messages/sec\n", producers, total, total / seconds / 1e6);
+
+	ExitThreads();
+	CB_Term();
+	TMR_Term();
+	ALLOC_Term();
+	return 0;
+}
@@ -0,0 +1,178 @@
+// XAllocBenchmark measures XALLOC_Alloc() plus XALLOC_Free() for XAllocData
+// instances of 2, 8 and 32 block sizes. The time per pair is dominated by 
+// choosing the allocator for a size once the block comes from the pool.
+// Every size is also checked to get the smallest block size that holds it.
+//
+// Usage:
+// XAllocBenchmark [iterations]
+//
+// iterations  alloc and free pairs timed per test (default 20000000)
+
+#include "x_allocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _MSC_VER
+#include <Windows.h>
+#endif
+
+#define BLOCKS  16
+
+ALLOC_DEFINE_ALIGNED(xb16, 16, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb32, 32, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb48, 48, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb64, 64, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb80, 80, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb96, 96, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb112, 112, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb128, 128, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb160, 160, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb176, 176, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb192, 192, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb208, 208, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb224, 224, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb240, 240, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb256, 256, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb288, 288, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb320, 320, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb384, 384, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb448, 448, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb512, 512, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb640, 640, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb768, 768, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb896, 896, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb1024, 1024, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb1280, 1280, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb1536, 1536, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb1792, 1792, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb2048, 2048, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb2560, 2560, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb3072, 3072, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb3584, 3584, BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(xb4096, 4096, BLOCKS, 16)
+
+// Allocator arrays sorted by smallest block first. All end with a 4096 
+// byte block so each test draws sizes from the same range.
+static ALLOC_Allocator* allocators2[] = {
+    &xb128Obj, &xb4096Obj
+};
+
+static ALLOC_Allocator* allocators8[] = {
+    &xb32Obj, &xb128Obj, &xb256Obj, &xb512Obj, &xb1024Obj, &xb2048Obj, &xb3072Obj, &xb4096Obj
+};
+
+static ALLOC_Allocator* allocators32[] = {
+    &xb16Obj, &xb32Obj, &xb48Obj, &xb64Obj, &xb80Obj, &xb96Obj, &xb112Obj, &xb128Obj,
+    &xb160Obj, &xb176Obj, &xb192Obj, &xb208Obj, &xb224Obj, &xb240Obj, &xb256Obj, &xb288Obj,
+    &xb320Obj, &xb384Obj, &xb448Obj, &xb512Obj, &xb640Obj, &xb768Obj, &xb896Obj, &xb1024Obj,
+    &xb1280Obj, &xb1536Obj, &xb1792Obj, &xb2048Obj, &xb2560Obj, &xb3072Obj, &xb3584Obj, &xb4096Obj
+};
+
+#define COUNT_OF(_array_)   (sizeof(_array_) / sizeof(_array_[0]))
+
+static XAllocData xalloc2 = XALLOC_DATA_INIT(allocators2, COUNT_OF(allocators2));
+static XAllocData xalloc8 = XALLOC_DATA_INIT(allocators8, COUNT_OF(allocators8));
+static XAllocData xalloc32 = XALLOC_DATA_INIT(allocators32, COUNT_OF(allocators32));
+
+// Random request sizes, replayed in order by each test
+#define SIZES   4096
+static size_t sizes[SIZES];
+
+//----------------------------------------------------------------------------
+// GetTimeSec
+//----------------------------------------------------------------------------
+static double GetTimeSec(void)
+{
+#ifdef _MSC_VER
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// IsSmallestBlock
+//----------------------------------------------------------------------------
+static BOOL IsSmallestBlock(XAllocData* self, void* ptr, size_t size)
+{
+    UINT16 i;
+
+    // The first allocator that can hold the size must own the block
+    for (i = 0; i < self->maxAllocators; i++)
+    {
+        if (self->allocators[i]->blockSize >= size + XALLOC_BLOCK_META_DATA_SIZE)
+            return ALLOC_OwnsBlock(self->allocators[i], ptr);
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------------
+// RunTest
+//----------------------------------------------------------------------------
+static BOOL RunTest(XAllocData* self, long iterations)
+{
+    const size_t maxSize = 4096 - XALLOC_BLOCK_META_DATA_SIZE;
+    double start;
+    size_t size;
+    long i;
+
+    for (size = 1; size <= maxSize; size++)
+    {
+        void* ptr = XALLOC_Alloc(self, size);
+        BOOL ok = IsSmallestBlock(self, ptr, size);
+        XALLOC_Free(ptr);
+        if (!ok)
+        {
+            printf("%u classes: size %u got the wrong block size\n", self->maxAllocators, (unsigned)size);
+            return FALSE;
+        }
+    }
+
+    start = GetTimeSec();
+    for (i = 0; i < iterations; i++)
+        XALLOC_Free(XALLOC_Alloc(self, sizes[i & (SIZES - 1)]));
+    printf("%u classes: %.1f ns per alloc and free (random sizes)\n", self->maxAllocators,
+        (GetTimeSec() - start) * 1e9 / iterations);
+
+    start = GetTimeSec();
+    for (i = 0; i < iterations; i++)
+        XALLOC_Free(XALLOC_Alloc(self, maxSize));
+    printf("%u classes: %.1f ns per alloc and free (largest size)\n", self->maxAllocators,
+        (GetTimeSec() - start) * 1e9 / iterations);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// main
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    long iterations = (argc > 1) ? atol(argv[1]) : 20000000;
+    unsigned seed = 1;
+    int i;
+
+    if (iterations < 1)
+    {
+        fprintf(stderr, "Usage: XAllocBenchmark [iterations]\n");
+        return 1;
+    }
+
+    ALLOC_Init();
+    for (i = 0; i < SIZES; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        sizes[i] = (seed >> 8) % (4096 - XALLOC_BLOCK_META_DATA_SIZE) + 1;
+    }
+
+    if (!RunTest(&xalloc2, iterations) || !RunTest(&xalloc8, iterations) || !RunTest(&xalloc32, iterations))
+        return 1;
+
+    ALLOC_Term();
+    return 0;
+}
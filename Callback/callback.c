@@ -1,9 +1,13 @@
 #include "callback.h"
 #include "DataTypes.h"
 #include "Fault.h"
+#include "Atomic.h"
+#include "ThreadLocal.h"
 #include <string.h>
 
-// Define USE_LOCK to use the default lock implementation
+// Define USE_LOCK to use the default lock implementation. The lock 
+// serializes registration changes. Dispatch reads the registrations 
+// without a lock, guarded by each array's sequence count.
 #define USE_LOCKS
 #ifdef USE_LOCKS
     #include "LockGuard.h"
@@ -22,77 +26,493 @@
 // Define USE_CALLBACK_ALLOCATOR to use the fixed block allocator instead of heap
 #define USE_CALLBACK_ALLOCATOR
 #ifdef USE_CALLBACK_ALLOCATOR
-    #define XALLOC(size)    CBALLOC_Alloc(size)
-    #define XFREE(ptr)      CBALLOC_Free(ptr)
+    #define XALLOC(size)                    CBALLOC_Alloc(size)
+    #define XFREE(ptr)                      CBALLOC_Free(ptr)
+    #define XALLOC_BATCH(size, count, ptrs) CBALLOC_AllocBatch(size, count, ptrs)
+    #define XFREE_BATCH(count, ptrs)        CBALLOC_FreeBatch(count, ptrs)
+    #define XALLOC_MAX_BLOCK()              CBALLOC_MaxBlockSize()
 #else
     #include <stdlib.h>
-    #define XALLOC(size)    malloc(size)
-    #define XFREE(ptr)      free(ptr)
+    #define XALLOC(size)                    malloc(size)
+    #define XFREE(ptr)                      free(ptr)
+    #define XALLOC_BATCH(size, count, ptrs) CB_HeapAllocBatch(size, count, ptrs)
+    #define XFREE_BATCH(count, ptrs)        CB_HeapFreeBatch(count, ptrs)
+
+    // Heap blocks have no size limit. Keep inline and shared data small.
+    #define XALLOC_MAX_BLOCK()              ((size_t)128)
+
+    static BOOL CB_HeapAllocBatch(size_t size, UINT32 count, void* ptrs[]);
+    static void CB_HeapFreeBatch(UINT32 count, void* const ptrs[]);
 #endif
 
-static BOOL CB_DispatchCallback(const CB_Info* cbInfo, const void* cbData, size_t cbDataSize);
+// Registrations copied and dispatched at a time. _CB_Dispatch() allocates 
+// the messages and data copies of each group's asynchronous targets with 
+// one lock acquisition per allocator.
+#define CB_DISPATCH_BATCH   16
+
+// Largest block of the callback allocator, read by CB_Init(). Callback data
+// is stored inline (CB_MSG_INLINE) or shared (CB_MSG_SHARED) only if the 
+// block holding it, with its header, is no larger. Otherwise each target 
+// gets a separate copy.
+static size_t _maxBlockSize;
+
+// Smallest callback data shared by the targets of a dispatch (CB_MSG_SHARED)
+// instead of copied per target
+#define CB_SHARED_MIN_SIZE  64
+
+// Header of shared callback data. The data follows at CB_SHARED_DATA_OFFSET.
+typedef struct
+{
+    volatile UINT32 refCount;   // Messages not yet invoked
+} CB_SharedData;
+
+#define CB_SHARED_DATA_OFFSET   ((sizeof(CB_SharedData) + 15) & ~(size_t)15)
+
+// Get the CB_SharedData header of shared callback data
+#define CB_GET_SHARED_DATA(_cbData_) \
+    ((CB_SharedData*)((char*)(_cbData_) - CB_SHARED_DATA_OFFSET))
 
+// Maximum number of distinct dispatch functions held by one publish batch.
+// Messages to further targets are dispatched without batching.
+#define CB_BATCH_MAX_TARGETS    8
+
+// Maximum number of dispatch functions with a chain dispatch function
+#define CB_MAX_CHAIN_DISPATCH   32
+
+// Messages held for one target by a publish batch
+typedef struct
+{
+    CB_DispatchCallbackFuncType dispatchFunc;
+    CB_CallbackMsg* pFirst;
+    CB_CallbackMsg* pLast;
+} CB_Chain;
+
+// A thread's publish batch
+typedef struct
+{
+    UINT32 depth;           // Nested CB_BatchBegin() calls
+    UINT32 count;
+    CB_Chain chains[CB_BATCH_MAX_TARGETS];
+} CB_Batch;
+
+static THREAD_LOCAL CB_Batch _batch;
+
+// Chain dispatch functions. Entries are only added; readers load 
+// _chainDispatchCount and search without a lock.
+typedef struct
+{
+    CB_DispatchCallbackFuncType dispatchFunc;
+    CB_DispatchChainFuncType chainFunc;
+} CB_ChainDispatch;
+
+static CB_ChainDispatch _chainDispatch[CB_MAX_CHAIN_DISPATCH];
+static volatile UINT32 _chainDispatchCount;
+
+// Maximum number of dispatch functions that queue to one thread
+#define CB_MAX_THREAD_DISPATCH  4
+
+// The calling thread's dispatch functions and its direct callback state
+typedef struct
+{
+    CB_DispatchCallbackFuncType dispatchFuncs[CB_MAX_THREAD_DISPATCH];
+    UINT32 dispatchCount;
+    UINT32 invokeDepth;         // Callbacks executing from messages or directly
+    CB_CallbackMsg* pFirst;     // Deferred direct callbacks, oldest first
+    CB_CallbackMsg* pLast;
+} CB_Thread;
+
+static THREAD_LOCAL CB_Thread _thread;
+
+static void CB_ReleaseSharedData(const void* cbData);
+static BOOL CB_IsThreadDispatch(CB_DispatchCallbackFuncType dispatchFunc);
+static BOOL CB_DeferMsg(const CB_CallbackMsg* cbMsg);
+static void CB_InvokeDirect(const CB_Info* cbInfo, const void* cbData, size_t cbDataSize);
+static void CB_InvokeDeferred(void);
+static void CB_FreeMsg(const CB_CallbackMsg* cbMsg);
+static BOOL CB_PostMsg(CB_DispatchCallbackFuncType dispatchFunc, CB_CallbackMsg* cbMsg);
+static void CB_PostChain(const CB_Chain* chain);
+static void CB_WriteBegin(volatile UINT32* cbSeq);
+static void CB_WriteEnd(volatile UINT32* cbSeq);
+static void CB_ReadInfo(const CB_Info* cbInfo, size_t count, volatile UINT32* cbSeq, CB_Info* copy);
+static BOOL CB_DispatchBatch(const CB_Info* const cbInfo[], UINT32 count, const void* cbData, size_t cbDataSize);
+
+#ifndef USE_CALLBACK_ALLOCATOR
 //----------------------------------------------------------------------------
-// CB_DispatchCallback
+// CB_HeapAllocBatch
 //----------------------------------------------------------------------------
-static BOOL CB_DispatchCallback(const CB_Info* cbInfo, const void* cbData, size_t cbDataSize)
+static BOOL CB_HeapAllocBatch(size_t size, UINT32 count, void* ptrs[])
 {
-    BOOL success = FALSE;
-    BOOL dispatchSuccess = FALSE;
-    CB_CallbackMsg* cbMsg = NULL;
-    void* cbDataCopy = NULL;
+    UINT32 idx;
 
-    ASSERT_TRUE(cbInfo);
+    for (idx = 0; idx < count; idx++)
+    {
+        ptrs[idx] = malloc(size);
+        if (!ptrs[idx])
+        {
+            CB_HeapFreeBatch(idx, ptrs);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// CB_HeapFreeBatch
+//----------------------------------------------------------------------------
+static void CB_HeapFreeBatch(UINT32 count, void* const ptrs[])
+{
+    UINT32 idx;
+
+    for (idx = 0; idx < count; idx++)
+        free(ptrs[idx]);
+}
+#endif
+
+//----------------------------------------------------------------------------
+// CB_WriteBegin
+//----------------------------------------------------------------------------
+static void CB_WriteBegin(volatile UINT32* cbSeq)
+{
+    // An odd count tells readers a registration is changing
+    if (cbSeq)
+    {
+        ATOMIC_Add32(cbSeq, 1);
+        ATOMIC_FenceRelease();
+    }
+}
+
+//----------------------------------------------------------------------------
+// CB_WriteEnd
+//----------------------------------------------------------------------------
+static void CB_WriteEnd(volatile UINT32* cbSeq)
+{
+    if (cbSeq)
+        ATOMIC_Add32(cbSeq, 1);
+}
+
+//----------------------------------------------------------------------------
+// CB_ReadInfo
+//----------------------------------------------------------------------------
+static void CB_ReadInfo(const CB_Info* cbInfo, size_t count, volatile UINT32* cbSeq, CB_Info* copy)
+{
+    UINT32 seq;
+
+    if (!cbSeq)
+    {
+        memcpy(copy, cbInfo, count * sizeof(CB_Info));
+        return;
+    }
+
+    // Copy the registrations. Retry if one changed during the copy.
+    for (;;)
+    {
+        seq = ATOMIC_Load32(cbSeq);
+        if ((seq & 1) == 0)
+        {
+            memcpy(copy, cbInfo, count * sizeof(CB_Info));
+
+            ATOMIC_FenceAcquire();
+            if (ATOMIC_Load32(cbSeq) == seq)
+                break;
+        }
+        ATOMIC_Pause();
+    }
+}
+
+//----------------------------------------------------------------------------
+// CB_ReleaseSharedData
+//----------------------------------------------------------------------------
+static void CB_ReleaseSharedData(const void* cbData)
+{
+    CB_SharedData* shared = CB_GET_SHARED_DATA(cbData);
+
+    // The last message to release the data frees it
+    if (ATOMIC_Add32(&shared->refCount, (UINT32)-1) == 0)
+        XFREE(shared);
+}
+
+//----------------------------------------------------------------------------
+// CB_IsThreadDispatch
+//----------------------------------------------------------------------------
+static BOOL CB_IsThreadDispatch(CB_DispatchCallbackFuncType dispatchFunc)
+{
+    UINT32 idx;
+
+    for (idx = 0; idx < _thread.dispatchCount; idx++)
+    {
+        if (_thread.dispatchFuncs[idx] == dispatchFunc)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------------
+// CB_DeferMsg
+//----------------------------------------------------------------------------
+static BOOL CB_DeferMsg(const CB_CallbackMsg* cbMsg)
+{
+    // The deferral queue is the target task's queue, so the queue node is 
+    // free to link the message
+    CB_CallbackMsg* deferredMsg = (CB_CallbackMsg*)cbMsg;
+
+    deferredMsg->queueNode.pNext = NULL;
+    if (_thread.pLast)
+        _thread.pLast->queueNode.pNext = &deferredMsg->queueNode;
+    else
+        _thread.pFirst = deferredMsg;
+    _thread.pLast = deferredMsg;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// CB_InvokeDirect
+//----------------------------------------------------------------------------
+static void CB_InvokeDirect(const CB_Info* cbInfo, const void* cbData, size_t cbDataSize)
+{
+    // A callback is executing on this thread, typically a state function
+    // within its message. Copy the data, since the publisher's data may not
+    // outlive the state function, and run the callback once the outermost 
+    // callback returns, so each runs to completion.
+    if (_thread.invokeDepth > 0)
+    {
+        CB_Info deferInfo = *cbInfo;
+        const CB_Info* target = &deferInfo;
+
+        deferInfo.cbDispatchFunc = CB_DeferMsg;
+        CB_DispatchBatch(&target, 1, cbData, cbDataSize);
+        return;
+    }
+
+    // Invoke the callback function with the publisher's data
+    _thread.invokeDepth++;
+    cbInfo->cbFunc(cbData, cbInfo->cbUserData);
+    _thread.invokeDepth--;
+
+    CB_InvokeDeferred();
+}
+
+//----------------------------------------------------------------------------
+// CB_InvokeDeferred
+//----------------------------------------------------------------------------
+static void CB_InvokeDeferred(void)
+{
+    // Run the deferred direct callbacks, including any they defer. The 
+    // depth keeps the CB_TargetInvoke() calls below from draining too.
+    _thread.invokeDepth++;
+    while (_thread.pFirst)
+    {
+        CB_CallbackMsg* cbMsg = _thread.pFirst;
+        MPSC_Node* pNext = cbMsg->queueNode.pNext;
+
+        _thread.pFirst = pNext ? CB_GET_QUEUED_MSG(pNext) : NULL;
+        if (!_thread.pFirst)
+            _thread.pLast = NULL;
+
+        CB_TargetInvoke(cbMsg);
+    }
+    _thread.invokeDepth--;
+}
+
+//----------------------------------------------------------------------------
+// CB_FreeMsg
+//----------------------------------------------------------------------------
+static void CB_FreeMsg(const CB_CallbackMsg* cbMsg)
+{
+    // Drop the message's reference to shared data
+    if (cbMsg->cbFlags & CB_MSG_SHARED)
+        CB_ReleaseSharedData(cbMsg->cbData);
+
+    // Inline and shared data are not freed with the message
+    if (cbMsg->cbFlags & (CB_MSG_INLINE | CB_MSG_SHARED))
+    {
+        XFREE((void*)cbMsg);
+        return;
+    }
+
+    // Free data sent through OS queue. The message and its data share an 
+    // allocator lock when both blocks come from the same allocator.
+    {
+        void* blocks[2];
+        blocks[0] = (void*)cbMsg->cbData;
+        blocks[1] = (void*)cbMsg;
+        XFREE_BATCH(2, blocks);
+    }
+}
+
+//----------------------------------------------------------------------------
+// CB_PostMsg
+//----------------------------------------------------------------------------
+static BOOL CB_PostMsg(CB_DispatchCallbackFuncType dispatchFunc, CB_CallbackMsg* cbMsg)
+{
+    UINT32 idx;
+
+    // Dispatch the callback message onto the OS task now unless batching.
+    // Deferred direct callbacks are never batched.
+    if (_batch.depth == 0 || dispatchFunc == CB_DeferMsg)
+        return dispatchFunc(cbMsg);
+
+    // Find or add the chain of messages held for the target
+    for (idx = 0; idx < _batch.count; idx++)
+    {
+        if (_batch.chains[idx].dispatchFunc == dispatchFunc)
+            break;
+    }
+    if (idx == _batch.count)
+    {
+        if (_batch.count == CB_BATCH_MAX_TARGETS)
+            return dispatchFunc(cbMsg);
+
+        _batch.chains[idx].dispatchFunc = dispatchFunc;
+        _batch.chains[idx].pFirst = NULL;
+        _batch.chains[idx].pLast = NULL;
+        _batch.count++;
+    }
 
-    // Is an OS task dispatch function defined? 
-    if (cbInfo->cbDispatchFunc == NULL)
+    // Link the message to the end of the chain through its queue node
+    cbMsg->queueNode.pNext = NULL;
+    if (_batch.chains[idx].pLast)
+        _batch.chains[idx].pLast->queueNode.pNext = &cbMsg->queueNode;
+    else
+        _batch.chains[idx].pFirst = cbMsg;
+    _batch.chains[idx].pLast = cbMsg;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// CB_PostChain
+//----------------------------------------------------------------------------
+static void CB_PostChain(const CB_Chain* chain)
+{
+    CB_DispatchChainFuncType chainFunc = NULL;
+    CB_CallbackMsg* cbMsg;
+    UINT32 count = ATOMIC_Load32(&_chainDispatchCount);
+    UINT32 idx;
+
+    for (idx = 0; idx < count; idx++)
+    {
+        if (_chainDispatch[idx].dispatchFunc == chain->dispatchFunc)
+        {
+            chainFunc = _chainDispatch[idx].chainFunc;
+            break;
+        }
+    }
+
+    // Queue the whole chain onto the OS task at once
+    if (chainFunc && chainFunc(chain->pFirst, chain->pLast))
+        return;
+
+    // Otherwise dispatch, or if the task refused the chain free, each message
+    cbMsg = chain->pFirst;
+    while (cbMsg)
     {
-        ASSERT_TRUE(cbInfo->cbFunc);
+        MPSC_Node* pNext = cbMsg->queueNode.pNext;
+
+        if (chainFunc || !chain->dispatchFunc(cbMsg))
+            CB_FreeMsg(cbMsg);
+
+        cbMsg = pNext ? CB_GET_QUEUED_MSG(pNext) : NULL;
+    }
+}
+
+//----------------------------------------------------------------------------
+// CB_DispatchBatch
+//----------------------------------------------------------------------------
+static BOOL CB_DispatchBatch(const CB_Info* const cbInfo[], UINT32 count, const void* cbData, size_t cbDataSize)
+{
+    BOOL success = FALSE;
+    BOOL dataShared;
+    BOOL dataInline;
+    CB_SharedData* shared = NULL;
+    size_t cbMsgSize = sizeof(CB_CallbackMsg);
+    void* cbMsgs[CB_DISPATCH_BATCH];
+    void* cbDataCopies[CB_DISPATCH_BATCH];
+    UINT32 idx;
+
+    ASSERT_TRUE(count <= CB_DISPATCH_BATCH);
+
+    // Share larger callback data between targets. Store small callback data
+    // within the message block itself.
+    dataShared = (count > 1 && cbDataSize >= CB_SHARED_MIN_SIZE && 
+        CB_SHARED_DATA_OFFSET + cbDataSize <= _maxBlockSize);
+    dataInline = (!dataShared && cbDataSize > 0 && CB_MSG_DATA_OFFSET + cbDataSize <= _maxBlockSize);
+    if (dataInline)
+        cbMsgSize = CB_MSG_DATA_OFFSET + cbDataSize;
+
+    // Allocate fixed block memory for every callback message at once
+    if (!XALLOC_BATCH(cbMsgSize, count, cbMsgs))
+    {
+        // Out of memory
+        ASSERT();
+        return FALSE;
+    }
+
+    if (dataShared)
+    {
+        // Allocate one copy of the callback data referenced by every message
+        shared = (CB_SharedData*)XALLOC(CB_SHARED_DATA_OFFSET + cbDataSize);
+        if (!shared)
+        {
+            XFREE_BATCH(count, cbMsgs);
+
+            // Out of memory
+            ASSERT();
+            return FALSE;
+        }
 
-        // No OS task dispatch function. Synchronously invoke callback function.
-        cbInfo->cbFunc(cbData, cbInfo->cbUserData);
-        return TRUE;
+        // Bitwise copy callback data argument once. Set the references 
+        // before any target can release one.
+        memcpy((char*)shared + CB_SHARED_DATA_OFFSET, cbData, cbDataSize);
+        shared->refCount = count;
     }
 
-    // Is there callback data?
-    if (cbDataSize > 0)
+    // Is there callback data too large to store inline?
+    else if (cbDataSize > 0 && !dataInline)
     {
-        // Allocate fixed block memory for callback argument data
-        cbDataCopy = XALLOC(cbDataSize);
+        // Allocate fixed block memory for each copy of the callback data
+        if (!XALLOC_BATCH(cbDataSize, count, cbDataCopies))
+        {
+            XFREE_BATCH(count, cbMsgs);
+
+            // Out of memory
+            ASSERT();
+            return FALSE;
+        }
     }
 
-    // Allocate fixed block memory for a callback message
-    cbMsg = (CB_CallbackMsg*)XALLOC(sizeof(CB_CallbackMsg));
-    if (cbMsg)
+    for (idx = 0; idx < count; idx++)
     {
-        if (cbDataCopy)
+        CB_CallbackMsg* cbMsg = (CB_CallbackMsg*)cbMsgs[idx];
+        void* cbDataCopy = NULL;
+
+        if (dataShared)
+        {
+            cbDataCopy = (char*)shared + CB_SHARED_DATA_OFFSET;
+        }
+        else if (cbDataSize > 0)
         {
             // Bitwise copy callback data argument
+            cbDataCopy = dataInline ? (char*)cbMsg + CB_MSG_DATA_OFFSET : cbDataCopies[idx];
             memcpy(cbDataCopy, cbData, cbDataSize);
         }
 
         // Copy callback function and argument data pointers into callback message
-        cbMsg->cbFunc = cbInfo->cbFunc;
+        cbMsg->cbFunc = cbInfo[idx]->cbFunc;
         cbMsg->cbData = cbDataCopy;
-        cbMsg->cbUserData = cbInfo->cbUserData;
-
-        // Dispatch the callback message onto the OS task
-        dispatchSuccess = cbInfo->cbDispatchFunc(cbMsg);
+        cbMsg->cbUserData = cbInfo[idx]->cbUserData;
+        cbMsg->cbFlags = dataShared ? CB_MSG_SHARED : (dataInline ? CB_MSG_INLINE : 0);
 
-        // Did the message get dispatched onto the OS task?
-        if (dispatchSuccess)
+        // Dispatch the callback message onto the OS task, or hold it for 
+        // the thread's publish batch
+        if (CB_PostMsg(cbInfo[idx]->cbDispatchFunc, cbMsg))
         {
             // Success! Callback dispatched to target task.
             success = TRUE;
         }
-    }
-    else
-    {
-        CBALLOC_Free(cbMsg);
-        CBALLOC_Free(cbDataCopy);
-
-        // Out of memory
-        ASSERT();
+        else
+        {
+            // Not queued. The message and data copy are still ours to free.
+            CB_FreeMsg(cbMsg);
+        }
     }
 
     return success;
@@ -104,6 +524,7 @@ static BOOL CB_DispatchCallback(const CB_Info* cbInfo, const void* cbData, size_
 void CB_Init(void)
 {
     _hLock = LK_CREATE();
+    _maxBlockSize = XALLOC_MAX_BLOCK();
 }
 
 //----------------------------------------------------------------------------
@@ -119,15 +540,116 @@ void CB_Term(void)
 //----------------------------------------------------------------------------
 void CB_TargetInvoke(const CB_CallbackMsg* cbMsg)
 {
+    UINT32 cbFlags;
+
     ASSERT_TRUE(cbMsg);
     ASSERT_TRUE(cbMsg->cbFunc);
 
+    // Read flags before invoking. A static message may be dispatched 
+    // again by the sender as soon as the callback function starts.
+    cbFlags = cbMsg->cbFlags;
+
     // Invoke callback function with the callback data
+    _thread.invokeDepth++;
     cbMsg->cbFunc(cbMsg->cbData, cbMsg->cbUserData);
+    _thread.invokeDepth--;
 
-    // Free data sent through OS queue
-    XFREE((void*)cbMsg->cbData);
-    XFREE((void*)cbMsg);
+    // Free data sent through OS queue. Sender owns the storage of a static
+    // message.
+    if (!(cbFlags & CB_MSG_STATIC))
+        CB_FreeMsg(cbMsg);
+
+    // Run the direct callbacks published by the callback once it completed
+    if (_thread.invokeDepth == 0 && _thread.pFirst)
+        CB_InvokeDeferred();
+}
+
+//----------------------------------------------------------------------------
+// CB_DiscardMsg
+//----------------------------------------------------------------------------
+void CB_DiscardMsg(const CB_CallbackMsg* cbMsg)
+{
+    ASSERT_TRUE(cbMsg);
+
+    // Sender owns the storage of a static message
+    if (cbMsg->cbFlags & CB_MSG_STATIC)
+        return;
+
+    CB_FreeMsg(cbMsg);
+}
+
+//----------------------------------------------------------------------------
+// CB_SetChainDispatch
+//----------------------------------------------------------------------------
+void CB_SetChainDispatch(CB_DispatchCallbackFuncType cbDispatchFunc, CB_DispatchChainFuncType cbChainFunc)
+{
+    UINT32 idx;
+
+    ASSERT_TRUE(cbDispatchFunc);
+
+    LK_LOCK(_hLock);
+
+    for (idx = 0; idx < _chainDispatchCount; idx++)
+    {
+        if (_chainDispatch[idx].dispatchFunc == cbDispatchFunc)
+            break;
+    }
+
+    if (idx < _chainDispatchCount)
+    {
+        _chainDispatch[idx].chainFunc = cbChainFunc;
+    }
+    else
+    {
+        ASSERT_TRUE(idx < CB_MAX_CHAIN_DISPATCH);
+
+        // Fill the entry before publishing the new count
+        _chainDispatch[idx].dispatchFunc = cbDispatchFunc;
+        _chainDispatch[idx].chainFunc = cbChainFunc;
+        ATOMIC_Store32(&_chainDispatchCount, idx + 1);
+    }
+
+    LK_UNLOCK(_hLock);
+}
+
+//----------------------------------------------------------------------------
+// CB_SetThreadDispatch
+//----------------------------------------------------------------------------
+void CB_SetThreadDispatch(CB_DispatchCallbackFuncType cbDispatchFunc)
+{
+    ASSERT_TRUE(cbDispatchFunc);
+
+    if (CB_IsThreadDispatch(cbDispatchFunc))
+        return;
+
+    ASSERT_TRUE(_thread.dispatchCount < CB_MAX_THREAD_DISPATCH);
+    _thread.dispatchFuncs[_thread.dispatchCount++] = cbDispatchFunc;
+}
+
+//----------------------------------------------------------------------------
+// CB_BatchBegin
+//----------------------------------------------------------------------------
+void CB_BatchBegin(void)
+{
+    _batch.depth++;
+}
+
+//----------------------------------------------------------------------------
+// CB_BatchCommit
+//----------------------------------------------------------------------------
+void CB_BatchCommit(void)
+{
+    UINT32 idx;
+
+    ASSERT_TRUE(_batch.depth > 0);
+
+    if (--_batch.depth > 0)
+        return;
+
+    // Hand each target its chain of held messages
+    for (idx = 0; idx < _batch.count; idx++)
+        CB_PostChain(&_batch.chains[idx]);
+    _batch.count = 0;
 }
 
 //----------------------------------------------------------------------------
@@ -135,9 +657,11 @@ void CB_TargetInvoke(const CB_CallbackMsg* cbMsg)
 //----------------------------------------------------------------------------
 BOOL _CB_AddCallback(CB_Info* cbInfo,
     size_t cbInfoLen,
+    volatile UINT32* cbSeq,
     CB_CallbackFuncType cbFunc,
     CB_DispatchCallbackFuncType cbDispatchFunc,
-    void* cbUserData)
+    void* cbUserData,
+    UINT32 cbRegFlags)
 {
     BOOL success = FALSE;
 
@@ -154,9 +678,12 @@ BOOL _CB_AddCallback(CB_Info* cbInfo,
         if (cbInfo[idx].cbFunc == NULL)
         {
             // Save callback information into cbInfo array
+            CB_WriteBegin(cbSeq);
             cbInfo[idx].cbFunc = cbFunc;
             cbInfo[idx].cbDispatchFunc = cbDispatchFunc;
             cbInfo[idx].cbUserData = cbUserData;
+            cbInfo[idx].cbFlags = cbRegFlags;
+            CB_WriteEnd(cbSeq);
             success = TRUE;
             break;
         }
@@ -174,6 +701,7 @@ BOOL _CB_AddCallback(CB_Info* cbInfo,
 //----------------------------------------------------------------------------
 BOOL _CB_RemoveCallback(CB_Info* cbInfo,
     size_t cbInfoLen,
+    volatile UINT32* cbSeq,
     CB_CallbackFuncType cbFunc,
     CB_DispatchCallbackFuncType cbDispatchFunc)
 {
@@ -192,10 +720,14 @@ BOOL _CB_RemoveCallback(CB_Info* cbInfo,
         if (cbInfo[idx].cbFunc == cbFunc &&
             cbInfo[idx].cbDispatchFunc == cbDispatchFunc)
         {
-            // Remove callback function pointer from cbInfo array
+            // Remove callback function pointer from cbInfo array. A dispatch
+            // that copied the registration beforehand may still call it.
+            CB_WriteBegin(cbSeq);
             cbInfo[idx].cbFunc = NULL;
             cbInfo[idx].cbDispatchFunc = NULL;
             cbInfo[idx].cbUserData = NULL;
+            cbInfo[idx].cbFlags = 0;
+            CB_WriteEnd(cbSeq);
             success = TRUE;
             break;
         }
@@ -208,60 +740,95 @@ BOOL _CB_RemoveCallback(CB_Info* cbInfo,
 //----------------------------------------------------------------------------
 // _CB_IsAdded
 //----------------------------------------------------------------------------
-BOOL _CB_IsAdded(CB_Info* cbInfo,
+BOOL _CB_IsAdded(const CB_Info* cbInfo,
     size_t cbInfoLen,
+    volatile UINT32* cbSeq,
     CB_CallbackFuncType cbFunc,
     CB_DispatchCallbackFuncType cbDispatchFunc)
 {
-    BOOL isAdded = FALSE;
+    CB_Info copy[CB_DISPATCH_BATCH];
+    size_t count;
 
     ASSERT_TRUE(cbInfo);
     ASSERT_TRUE(cbInfoLen > 0);
     ASSERT_TRUE(cbFunc);
 
-    LK_LOCK(_hLock);
-
     // Search for the registered data within the callback array
-    for (size_t idx = 0; idx<cbInfoLen; idx++)
+    for (size_t start = 0; start<cbInfoLen; start += count)
     {
-        // Does the caller's callback match?
-        if (cbInfo[idx].cbFunc == cbFunc &&
-            cbInfo[idx].cbDispatchFunc == cbDispatchFunc)
+        count = cbInfoLen - start;
+        if (count > CB_DISPATCH_BATCH)
+            count = CB_DISPATCH_BATCH;
+        CB_ReadInfo(&cbInfo[start], count, cbSeq, copy);
+
+        for (size_t idx = 0; idx<count; idx++)
         {
-            isAdded = TRUE;
-            break;
+            // Does the caller's callback match?
+            if (copy[idx].cbFunc == cbFunc &&
+                copy[idx].cbDispatchFunc == cbDispatchFunc)
+            {
+                return TRUE;
+            }
         }
     }
 
-    LK_UNLOCK(_hLock);
-    return isAdded;
+    return FALSE;
 }
 
 //----------------------------------------------------------------------------
 // _CB_Dispatch
 //----------------------------------------------------------------------------
-BOOL _CB_Dispatch(const CB_Info* cbInfo, size_t cbInfoLen, const void* cbData, 
-    size_t cbDataSize)
+BOOL _CB_Dispatch(const CB_Info* cbInfo, size_t cbInfoLen, volatile UINT32* cbSeq, 
+    const void* cbData, size_t cbDataSize)
 {
     BOOL invoked = FALSE;
+    CB_Info copy[CB_DISPATCH_BATCH];
+    const CB_Info* targets[CB_DISPATCH_BATCH];
+    size_t count;
 
-    LK_LOCK(_hLock);
-
-    // For each CB_Info instance within the array
-    for (size_t idx = 0; idx<cbInfoLen; idx++)
+    // For each group of CB_Info instances within the array. No lock is taken
+    // and nothing shared is written; each group is copied and dispatched.
+    for (size_t start = 0; start<cbInfoLen; start += count)
     {
-        // Is a client registered?
-        if (cbInfo[idx].cbFunc)
+        UINT32 targetCount = 0;
+
+        count = cbInfoLen - start;
+        if (count > CB_DISPATCH_BATCH)
+            count = CB_DISPATCH_BATCH;
+        CB_ReadInfo(&cbInfo[start], count, cbSeq, copy);
+
+        for (size_t idx = 0; idx<count; idx++)
         {
-            // Dispatch callback onto the OS task
-            if (CB_DispatchCallback(&cbInfo[idx], cbData, cbDataSize))
+            // Is a client registered?
+            if (copy[idx].cbFunc == NULL)
+                continue;
+
+            // Is an OS task dispatch function defined? 
+            if (copy[idx].cbDispatchFunc == NULL)
             {
+                // No OS task dispatch function. Synchronously invoke callback function.
+                copy[idx].cbFunc(cbData, copy[idx].cbUserData);
                 invoked = TRUE;
+                continue;
             }
+
+            // Is the publisher on the target's thread with direct invocation 
+            // allowed?
+            if ((copy[idx].cbFlags & CB_REG_DIRECT) && CB_IsThreadDispatch(copy[idx].cbDispatchFunc))
+            {
+                CB_InvokeDirect(&copy[idx], cbData, cbDataSize);
+                invoked = TRUE;
+                continue;
+            }
+
+            // Collect asynchronous targets to allocate their messages together
+            targets[targetCount++] = &copy[idx];
         }
+
+        // Dispatch callbacks onto the OS tasks of the targets
+        if (targetCount && CB_DispatchBatch(targets, targetCount, cbData, cbDataSize))
+            invoked = TRUE;
     }
 
-    LK_UNLOCK(_hLock);
     return invoked;
 }
-
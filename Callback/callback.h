@@ -55,6 +55,8 @@
 #include "callback_allocator.h"
 #include "callback_allocator.h"
 #include "DataTypes.h"
+#include "MpscQueue.h"
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -73,11 +75,43 @@ typedef struct
 
     // Optional user data passed back on each callback
     void* cbUserData;
+
+    // Message flags (CB_MSG_xxx)
+    UINT32 cbFlags;
+
+    // Intrusive link reserved for the target OS task. A dispatch function 
+    // may queue the message through this node without allocating a wrapper.
+    MPSC_Node queueNode;
 } CB_CallbackMsg;
 
+// Get the CB_CallbackMsg that contains a queueNode
+#define CB_GET_QUEUED_MSG(_node_) \
+    ((CB_CallbackMsg*)((char*)(_node_) - offsetof(CB_CallbackMsg, queueNode)))
+
+// The message storage is owned by the sender. CB_TargetInvoke() invokes 
+// the callback but does not free the message or callback data. A static
+// message must not be dispatched again until its callback has started.
+#define CB_MSG_STATIC       0x0001
+
+// The callback data is stored after the message, within the message's 
+// block, at offset CB_MSG_DATA_OFFSET. Freeing the message frees the data.
+#define CB_MSG_INLINE       0x0002
+
+// The callback data is one reference counted copy shared by the messages 
+// of all targets of a dispatch. The last CB_TargetInvoke() frees it.
+#define CB_MSG_SHARED       0x0004
+
+// Offset of inline callback data from the start of its CB_CallbackMsg
+#define CB_MSG_DATA_OFFSET  ((sizeof(CB_CallbackMsg) + 15) & ~(size_t)15)
+
 // Each OS task dispatch function must conform to this signature 
 typedef BOOL (*CB_DispatchCallbackFuncType)(const CB_CallbackMsg* cbMsg);
 
+// Optional OS task function that queues a chain of messages, linked from 
+// first to last through queueNode, with one queue operation and at most 
+// one wakeup. Returns FALSE if no message was queued.
+typedef BOOL (*CB_DispatchChainFuncType)(const CB_CallbackMsg* first, const CB_CallbackMsg* last);
+
 typedef struct
 {
     // A pointer to the registered callback function
@@ -88,8 +122,25 @@ typedef struct
 
     // Optional user data passed back on each callback
     void* cbUserData;
+
+    // Registration options (CB_REG_xxx)
+    UINT32 cbFlags;
 } CB_Info;
 
+// Invoke the asynchronous callback on the publisher's thread, skipping the 
+// queue and the thread switch, when it is published on the thread of its 
+// dispatch function (see CB_SetThreadDispatch()). Published from within a 
+// callback, e.g. a state function, the callback is held on a thread local 
+// list and invoked once the outermost CB_TargetInvoke() callback returns, 
+// so callbacks still run to completion and never nest. The publisher's data
+// may not outlive its callback, so a held callback still allocates a 
+// message and copies the data, as a queued one does. On a worker thread all 
+// code runs within a callback, so this is the path taken there; only the 
+// queue operation and the wakeup are saved. Published outside any callback,
+// it is invoked within the publisher's CB_Invoke() without a copy. 
+// Callbacks published from other threads are queued as usual.
+#define CB_REG_DIRECT       0x0001
+
 // User macros to ease using the callback wrapper functions.
 // cbName - the callback name as set within CB_DECLARE
 // cbFunc - a callback function matching the callback signature
@@ -101,7 +152,16 @@ typedef struct
 // cbUserData - optional data passed back during each callback. Can point to 
 //      anything the subscriber wants. Set to NULL if not using user data. 
 // e.g. CB_Register(MyCallback, TestCallbackFunc, DispatchFunc);
+// cbRegFlags - registration options (CB_REG_xxx)
+// e.g. CB_RegisterEx(MyCallback, TestCallbackFunc, DispatchFunc, NULL, CB_REG_DIRECT);
 #define CB_Register(cbName, cbFunc, cbDispatchFunc, cbUserData)  cbName##_Register(cbFunc, cbDispatchFunc, cbUserData)
+#define CB_RegisterEx(cbName, cbFunc, cbDispatchFunc, cbUserData, cbRegFlags) \
+    cbName##_RegisterEx(cbFunc, cbDispatchFunc, cbUserData, cbRegFlags)
+// CB_Invoke() reads the registrations without a lock, so a dispatch already 
+// in progress on another thread may still invoke a callback once after 
+// CB_Unregister() returns. Keep its cbUserData valid until the publisher can 
+// no longer be invoked. Asynchronous callback messages already queued to a 
+// task are still delivered.
 #define CB_Unregister(cbName, cbFunc, cbDispatchFunc)            cbName##_Unregister(cbFunc, cbDispatchFunc)
 #define CB_Invoke(cbName, cbArg)                                 cbName##_Invoke(cbArg)
 #define CB_InvokeArray(cbName, cbArg, cbNum, cbSize)             cbName##_InvokeArray(cbArg, cbNum, cbSize)
@@ -115,6 +175,7 @@ typedef struct
 #define CB_DECLARE(cbName, cbArg) \
     typedef void(*cbName##CallbackFuncType)(cbArg cbData, void* cbUserData); \
     BOOL cbName##_Register(cbName##CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, void* cbUserData); \
+    BOOL cbName##_RegisterEx(cbName##CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, void* cbUserData, UINT32 cbRegFlags); \
     BOOL cbName##_IsRegistered(cbName##CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc); \
     BOOL cbName##_Unregister(cbName##CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc); \
     BOOL cbName##_Invoke(cbArg cbData); \
@@ -129,20 +190,24 @@ typedef struct
 // e.g. CB_DEFINE(MyCallback, int*, sizeof(int), 2)
 #define CB_DEFINE(cbName, cbArg, cbArgSize, cbMax) \
     static CB_Info cbName##Multicast[cbMax]; \
+    static volatile UINT32 cbName##Seq; \
     BOOL cbName##_Register(cbName##CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, void* cbUserData) { \
-        return _CB_AddCallback(&cbName##Multicast[0], cbMax, (CB_CallbackFuncType)cbFunc, cbDispatchFunc, cbUserData); \
+        return _CB_AddCallback(&cbName##Multicast[0], cbMax, &cbName##Seq, (CB_CallbackFuncType)cbFunc, cbDispatchFunc, cbUserData, 0); \
+    } \
+    BOOL cbName##_RegisterEx(cbName##CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, void* cbUserData, UINT32 cbRegFlags) { \
+        return _CB_AddCallback(&cbName##Multicast[0], cbMax, &cbName##Seq, (CB_CallbackFuncType)cbFunc, cbDispatchFunc, cbUserData, cbRegFlags); \
     } \
     BOOL cbName##_IsRegistered(cbName##CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc) { \
-        return _CB_IsAdded(&cbName##Multicast[0], cbMax, (CB_CallbackFuncType)cbFunc, cbDispatchFunc); \
+        return _CB_IsAdded(&cbName##Multicast[0], cbMax, &cbName##Seq, (CB_CallbackFuncType)cbFunc, cbDispatchFunc); \
     } \
     BOOL cbName##_Unregister(cbName##CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc) { \
-        return _CB_RemoveCallback(&cbName##Multicast[0], cbMax, (CB_CallbackFuncType)cbFunc, cbDispatchFunc); \
+        return _CB_RemoveCallback(&cbName##Multicast[0], cbMax, &cbName##Seq, (CB_CallbackFuncType)cbFunc, cbDispatchFunc); \
     } \
     BOOL cbName##_Invoke(cbArg cbData) { \
-        return _CB_Dispatch(&cbName##Multicast[0], cbMax, cbData, cbArgSize); \
+        return _CB_Dispatch(&cbName##Multicast[0], cbMax, &cbName##Seq, cbData, cbArgSize); \
     } \
     BOOL cbName##_InvokeArray(cbArg cbData, size_t num, size_t size) { \
-        return _CB_Dispatch(&cbName##Multicast[0], cbMax, cbData, num * size); \
+        return _CB_Dispatch(&cbName##Multicast[0], cbMax, &cbName##Seq, cbData, num * size); \
     } \
     const CB_Info* cbName##_GetCbInfo(unsigned int cbIdx) { \
         if (cbIdx >= cbMax) return NULL; \
@@ -158,14 +223,42 @@ void CB_Term(void);
 // Called by a target OS task to invoke the callback function
 void CB_TargetInvoke(const CB_CallbackMsg* cbMsg);
 
+// Called by a target OS task to release a message it will not invoke, e.g.
+// one still queued when the task exits. A static message is left to its 
+// sender.
+void CB_DiscardMsg(const CB_CallbackMsg* cbMsg);
+
+// Set the chain dispatch function of an OS task dispatch function. Call 
+// before callbacks are dispatched to the task.
+void CB_SetChainDispatch(CB_DispatchCallbackFuncType cbDispatchFunc, CB_DispatchChainFuncType cbChainFunc);
+
+// Called by a target OS task, on its own thread, with a dispatch function
+// that queues to it. Callbacks registered with CB_REG_DIRECT on that 
+// dispatch function are then invoked directly when published on the thread.
+void CB_SetThreadDispatch(CB_DispatchCallbackFuncType cbDispatchFunc);
+
+// Begin and commit a publish batch on the calling thread. Between the two,
+// asynchronous callback messages are held and grouped by dispatch function.
+// CB_BatchCommit() hands each group to its target as one chain, so each 
+// target task is queued to and woken once per batch. Synchronous callbacks
+// are still invoked immediately. Batches may nest; the outermost commit 
+// posts the messages.
+void CB_BatchBegin(void);
+void CB_BatchCommit(void);
+
 // Private functions. Do not call these functions directly.
-BOOL _CB_AddCallback(CB_Info* cbInfo, size_t cbInfoLen, CB_CallbackFuncType cbFunc,
-    CB_DispatchCallbackFuncType cbDispatchFunc, void* cbUserData);
-BOOL _CB_IsAdded(CB_Info* cbInfo, size_t cbInfoLen, CB_CallbackFuncType cbFunc,
-    CB_DispatchCallbackFuncType cbDispatchFunc);
-BOOL _CB_RemoveCallback(CB_Info* cbInfo, size_t cbInfoLen, CB_CallbackFuncType cbFunc,
-    CB_DispatchCallbackFuncType cbDispatchFunc);
-BOOL _CB_Dispatch(const CB_Info* cbInfo, size_t cbInfoLen, const void* cbData, size_t cbDataSize);
+// cbSeq - the sequence count guarding the cbInfo array. The array is read 
+//      without a lock and the read retried if a registration changed it. 
+//      NULL if the caller keeps the array from changing.
+BOOL _CB_AddCallback(CB_Info* cbInfo, size_t cbInfoLen, volatile UINT32* cbSeq, 
+    CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, void* cbUserData, 
+    UINT32 cbRegFlags);
+BOOL _CB_IsAdded(const CB_Info* cbInfo, size_t cbInfoLen, volatile UINT32* cbSeq, 
+    CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc);
+BOOL _CB_RemoveCallback(CB_Info* cbInfo, size_t cbInfoLen, volatile UINT32* cbSeq, 
+    CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc);
+BOOL _CB_Dispatch(const CB_Info* cbInfo, size_t cbInfoLen, volatile UINT32* cbSeq, 
+    const void* cbData, size_t cbDataSize);
 
 #ifdef __cplusplus
 }
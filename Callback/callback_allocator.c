@@ -1,25 +1,40 @@
 #include "callback_allocator.h"
 #include "x_allocator.h"
 
-#define MAX_32_BLOCKS   20
+#ifdef CBALLOC_POOLS_HEADER
+// Use the pools generated by the PoolSizer tool from a profile of this 
+// allocator, e.g. -DCBALLOC_POOLS_HEADER=\"callback_pools.h\"
+#include CBALLOC_POOLS_HEADER
+
+CBALLOC_POOLS
+
+// An array of allocators sorted by smallest block first
+static ALLOC_Allocator* allocators[] = {
+    CBALLOC_ALLOCATORS
+};
+#else
+#define MAX_64_BLOCKS   20
 #define MAX_128_BLOCKS  10
 
-#define BLOCK_32_SIZE     32 + XALLOC_BLOCK_META_DATA_SIZE
+// A 64 byte block holds a CB_CallbackMsg with up to 16 bytes of inline 
+// callback data
+#define BLOCK_64_SIZE     64 + XALLOC_BLOCK_META_DATA_SIZE
 #define BLOCK_128_SIZE    128 + XALLOC_BLOCK_META_DATA_SIZE
 
-// Define individual fb_allocators
-ALLOC_DEFINE(cbDataAllocator32, BLOCK_32_SIZE, MAX_32_BLOCKS)
-ALLOC_DEFINE(cbDataAllocator128, BLOCK_128_SIZE, MAX_128_BLOCKS)
+// Define individual fb_allocators. Blocks are 16 byte aligned for SIMD access.
+ALLOC_DEFINE_ALIGNED(cbDataAllocator64, BLOCK_64_SIZE, MAX_64_BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(cbDataAllocator128, BLOCK_128_SIZE, MAX_128_BLOCKS, 16)
 
 // An array of allocators sorted by smallest block first
 static ALLOC_Allocator* allocators[] = {
-    &cbDataAllocator32Obj,
+    &cbDataAllocator64Obj,
     &cbDataAllocator128Obj
 };
+#endif
 
 #define MAX_ALLOCATORS   (sizeof(allocators) / sizeof(allocators[0]))
 
-static XAllocData self = { allocators, MAX_ALLOCATORS };
+static XAllocData self = XALLOC_DATA_INIT(allocators, MAX_ALLOCATORS);
 
 //----------------------------------------------------------------------------
 // CBALLOC_Alloc
@@ -53,3 +68,34 @@ void* CBALLOC_Calloc(size_t num, size_t size)
     return XALLOC_Calloc(&self, num, size);
 }
 
+//----------------------------------------------------------------------------
+// CBALLOC_AllocBatch
+//----------------------------------------------------------------------------
+BOOL CBALLOC_AllocBatch(size_t size, UINT32 count, void* ptrs[])
+{
+    return XALLOC_AllocBatch(&self, size, count, ptrs);
+}
+
+//----------------------------------------------------------------------------
+// CBALLOC_FreeBatch
+//----------------------------------------------------------------------------
+void CBALLOC_FreeBatch(UINT32 count, void* const ptrs[])
+{
+    XALLOC_FreeBatch(count, ptrs);
+}
+
+//----------------------------------------------------------------------------
+// CBALLOC_MaxBlockSize
+//----------------------------------------------------------------------------
+size_t CBALLOC_MaxBlockSize(void)
+{
+    return XALLOC_MaxBlockSize(&self);
+}
+
+//----------------------------------------------------------------------------
+// CBALLOC_ProfileSave
+//----------------------------------------------------------------------------
+BOOL CBALLOC_ProfileSave(const char* fileName)
+{
+    return XALLOC_ProfileSave(&self, "CBALLOC", fileName);
+}
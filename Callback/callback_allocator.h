@@ -5,6 +5,7 @@
 #ifndef _CALLBACK_ALLOCATOR_H
 #define _CALLBACK_ALLOCATOR_H
 
+#include "DataTypes.h"
 #include <stddef.h>
 
 #ifdef __cplusplus
@@ -16,6 +17,18 @@ void CBALLOC_Free(void* ptr);
 void* CBALLOC_Realloc(void *ptr, size_t new_size);
 void* CBALLOC_Calloc(size_t num, size_t size);
 
+// Allocate count blocks of size bytes, or free count blocks, with one lock
+// acquisition per allocator
+BOOL CBALLOC_AllocBatch(size_t size, UINT32 count, void* ptrs[]);
+void CBALLOC_FreeBatch(UINT32 count, void* const ptrs[]);
+
+// Get the largest size CBALLOC_Alloc() can allocate
+size_t CBALLOC_MaxBlockSize(void);
+
+// Write the request size profile recorded with USE_XALLOC_PROFILE to a file
+// for the PoolSizer tool. Returns FALSE if profiling is disabled.
+BOOL CBALLOC_ProfileSave(const char* fileName);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,278 @@
+// PoolSizer reads a request size profile written by XALLOC_ProfileSave() and
+// generates a header of ALLOC_DEFINE_ALIGNED statements for an x_allocator
+// wrapper module. The block sizes and counts chosen use the least memory
+// able to hold the recorded peak of live blocks without overflow.
+//
+// Usage:
+// PoolSizer <profile> <header> [-classes N] [-align A] [-headroom PCT]
+//
+// -classes   maximum number of block sizes (default 8)
+// -align     block alignment passed to ALLOC_DEFINE_ALIGNED (default 16)
+// -headroom  percent added to each block count (default 0)
+//
+// The peak of a block size is taken as the sum of the peaks of the request
+// sizes it serves. That may exceed the true peak, never undercount it.
+//
+// Build the wrapper with the header, e.g. for callback_allocator.c:
+// -DCBALLOC_POOLS_HEADER=\"cb_pools.h\"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Estimated memory used by an allocator object with no blocks
+static const unsigned long long ALLOCATOR_OVERHEAD = 192;
+
+// One recorded range of request sizes
+struct Bucket
+{
+	unsigned long long size;		// Largest request size in the range
+	unsigned long long requests;
+	unsigned long long peak;
+};
+
+// Recorded profile of one XAllocData
+struct Profile
+{
+	string name;
+	unsigned long long metadata = 0;
+	unsigned long long peak = 0;
+	unsigned long long untracked = 0;
+	unsigned long long maxSize = 0;	// Largest request recorded
+	vector<Bucket> buckets;
+};
+
+// A chosen block size
+struct PoolClass
+{
+	unsigned long long size;
+	unsigned long long blocks;
+};
+
+//----------------------------------------------------------------------------
+// ReadProfile
+//----------------------------------------------------------------------------
+static bool ReadProfile(const char* fileName, Profile& profile)
+{
+	ifstream file(fileName);
+	if (!file)
+		return false;
+
+	string line;
+	while (getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		istringstream fields(line);
+		string key;
+		fields >> key;
+		if (key == "name")
+			fields >> profile.name;
+		else if (key == "metadata")
+			fields >> profile.metadata;
+		else if (key == "peak")
+			fields >> profile.peak;
+		else if (key == "untracked")
+			fields >> profile.untracked;
+		else if (key == "maxsize")
+			fields >> profile.maxSize;
+		else if (key == "bucket")
+		{
+			Bucket bucket;
+			fields >> bucket.size >> bucket.requests >> bucket.peak;
+			if (fields && bucket.peak)
+				profile.buckets.push_back(bucket);
+		}
+	}
+
+	// Buckets are written in ascending size order. The last bucket also 
+	// collects requests beyond the recorded size ranges, so the largest 
+	// class must hold the largest request.
+	if (profile.buckets.empty())
+		return false;
+	if (profile.maxSize > profile.buckets.back().size)
+		profile.buckets.back().size = profile.maxSize;
+	return !profile.name.empty();
+}
+
+//----------------------------------------------------------------------------
+// AlignUp
+//----------------------------------------------------------------------------
+static unsigned long long AlignUp(unsigned long long value, unsigned long long align)
+{
+	return (value + align - 1) / align * align;
+}
+
+//----------------------------------------------------------------------------
+// ChooseClasses
+//----------------------------------------------------------------------------
+static vector<PoolClass> ChooseClasses(const Profile& profile, size_t maxClasses,
+	unsigned long long align, unsigned long long headroom)
+{
+	const vector<Bucket>& b = profile.buckets;
+	const size_t n = b.size();
+	const unsigned long long INF = ~0ULL;
+
+	// Blocks needed if buckets [first, last] share one block size
+	auto blocks = [&](size_t first, size_t last)
+	{
+		unsigned long long peak = 0;
+		for (size_t i = first; i <= last; i++)
+			peak += b[i].peak;
+		return (peak * (100 + headroom) + 99) / 100;
+	};
+
+	// Memory used if buckets [first, last] share one block size
+	auto cost = [&](size_t first, size_t last)
+	{
+		unsigned long long blockSize = AlignUp(b[last].size + profile.metadata, align);
+		return blockSize * blocks(first, last) + ALLOCATOR_OVERHEAD;
+	};
+
+	// best[k][j] is the least memory to serve buckets [0, j) with k block
+	// sizes. from[k][j] is the first bucket served by the last block size.
+	if (maxClasses > n)
+		maxClasses = n;
+	vector<vector<unsigned long long>> best(maxClasses + 1, vector<unsigned long long>(n + 1, INF));
+	vector<vector<size_t>> from(maxClasses + 1, vector<size_t>(n + 1, 0));
+	best[0][0] = 0;
+	for (size_t k = 1; k <= maxClasses; k++)
+	{
+		for (size_t j = 1; j <= n; j++)
+		{
+			for (size_t i = k - 1; i < j; i++)
+			{
+				if (best[k - 1][i] == INF)
+					continue;
+				unsigned long long total = best[k - 1][i] + cost(i, j - 1);
+				if (total < best[k][j])
+				{
+					best[k][j] = total;
+					from[k][j] = i;
+				}
+			}
+		}
+	}
+
+	// Use the number of block sizes with the least memory
+	size_t bestK = 1;
+	for (size_t k = 2; k <= maxClasses; k++)
+	{
+		if (best[k][n] < best[bestK][n])
+			bestK = k;
+	}
+
+	vector<PoolClass> classes(bestK);
+	size_t j = n;
+	for (size_t k = bestK; k > 0; k--)
+	{
+		size_t i = from[k][j];
+		classes[k - 1].size = b[j - 1].size;
+		classes[k - 1].blocks = blocks(i, j - 1);
+		j = i;
+	}
+	return classes;
+}
+
+//----------------------------------------------------------------------------
+// WriteHeader
+//----------------------------------------------------------------------------
+static bool WriteHeader(const char* fileName, const char* profileName, const Profile& profile,
+	const vector<PoolClass>& classes, unsigned long long align)
+{
+	FILE* fp = fopen(fileName, "w");
+	if (!fp)
+		return false;
+
+	unsigned long long requests = 0;
+	for (const Bucket& bucket : profile.buckets)
+		requests += bucket.requests;
+	unsigned long long memory = 0;
+	for (const PoolClass& c : classes)
+		memory += AlignUp(c.size + profile.metadata, align) * c.blocks;
+
+	const char* name = profile.name.c_str();
+	fprintf(fp, "// Generated by PoolSizer from %s. Do not edit.\n", profileName);
+	fprintf(fp, "// %llu requests, peak of %llu live blocks, %llu bytes of blocks.\n\n",
+		requests, profile.peak, memory);
+	fprintf(fp, "#ifndef _%s_POOLS_H\n#define _%s_POOLS_H\n\n", name, name);
+
+	fprintf(fp, "#define %s_POOLS \\\n", name);
+	for (size_t i = 0; i < classes.size(); i++)
+	{
+		fprintf(fp, "    ALLOC_DEFINE_ALIGNED(%s_Pool%llu, %llu + XALLOC_BLOCK_META_DATA_SIZE, %llu, %llu)%s\n",
+			name, classes[i].size, classes[i].size, classes[i].blocks, align,
+			(i + 1 < classes.size()) ? " \\" : "");
+	}
+
+	fprintf(fp, "\n#define %s_ALLOCATORS \\\n", name);
+	for (size_t i = 0; i < classes.size(); i++)
+	{
+		fprintf(fp, "    &%s_Pool%lluObj%s\n", name, classes[i].size,
+			(i + 1 < classes.size()) ? ", \\" : "");
+	}
+
+	fprintf(fp, "\n#endif\n");
+	fclose(fp);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// main
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		fprintf(stderr, "Usage: PoolSizer <profile> <header> [-classes N] [-align A] [-headroom PCT]\n");
+		return 1;
+	}
+
+	size_t maxClasses = 8;
+	unsigned long long align = 16;
+	unsigned long long headroom = 0;
+	for (int i = 3; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "-classes") == 0)
+			maxClasses = strtoul(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "-align") == 0)
+			align = strtoull(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "-headroom") == 0)
+			headroom = strtoull(argv[i + 1], NULL, 10);
+	}
+	if (maxClasses < 1 || maxClasses > 255 || align == 0 || (align & (align - 1)))
+	{
+		fprintf(stderr, "PoolSizer: -classes must be 1 to 255 and -align a power of two\n");
+		return 1;
+	}
+
+	Profile profile;
+	if (!ReadProfile(argv[1], profile))
+	{
+		fprintf(stderr, "PoolSizer: cannot read profile %s\n", argv[1]);
+		return 1;
+	}
+	if (profile.untracked)
+	{
+		fprintf(stderr, "PoolSizer: warning, %llu blocks were not tracked. Increase XALLOC_PROFILE_MAX_LIVE.\n",
+			profile.untracked);
+	}
+
+	vector<PoolClass> classes = ChooseClasses(profile, maxClasses, align, headroom);
+	if (!WriteHeader(argv[2], argv[1], profile, classes, align))
+	{
+		fprintf(stderr, "PoolSizer: cannot write %s\n", argv[2]);
+		return 1;
+	}
+
+	for (const PoolClass& c : classes)
+		printf("%s: %llu byte blocks x %llu\n", profile.name.c_str(), c.size, c.blocks);
+	return 0;
+}
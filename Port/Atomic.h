@@ -0,0 +1,88 @@
+#ifndef _ATOMIC_H
+#define _ATOMIC_H
+
+// Atomic operations on naturally aligned 32-bit, 64-bit and pointer sized
+// values. All operations are sequentially consistent except the Release 
+// store, which only orders earlier memory accesses before it (e.g. to 
+// unlock). The macros are usable from both C and C++ source files.
+
+#include "DataTypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+
+    #define ATOMIC_Load32(p)                    ((UINT32)InterlockedOr((volatile LONG*)(p), 0))
+    #define ATOMIC_Store32(p, v)                ((void)InterlockedExchange((volatile LONG*)(p), (LONG)(v)))
+    #define ATOMIC_Exchange32(p, v)             ((UINT32)InterlockedExchange((volatile LONG*)(p), (LONG)(v)))
+    #define ATOMIC_Add32(p, v)                  ((UINT32)(InterlockedExchangeAdd((volatile LONG*)(p), (LONG)(v)) + (LONG)(v)))
+    #define ATOMIC_CompareExchange32(p, e, d)   (InterlockedCompareExchange((volatile LONG*)(p), (LONG)(d), (LONG)(e)) == (LONG)(e))
+    #if defined(_M_IX86) || defined(_M_X64)
+        // x86 stores already have release semantics. Only stop the compiler reordering.
+        #define ATOMIC_StoreRelease32(p, v)     (_ReadWriteBarrier(), (void)(*(volatile LONG*)(p) = (LONG)(v)))
+    #else
+        #define ATOMIC_StoreRelease32(p, v)     ATOMIC_Store32(p, v)
+    #endif
+
+    #define ATOMIC_LoadPtr(p)                   InterlockedCompareExchangePointer((PVOID volatile*)(p), NULL, NULL)
+    #define ATOMIC_StorePtr(p, v)               ((void)InterlockedExchangePointer((PVOID volatile*)(p), (PVOID)(v)))
+    #define ATOMIC_ExchangePtr(p, v)            InterlockedExchangePointer((PVOID volatile*)(p), (PVOID)(v))
+    #define ATOMIC_CompareExchangePtr(p, e, d)  (InterlockedCompareExchangePointer((PVOID volatile*)(p), (PVOID)(d), (PVOID)(e)) == (PVOID)(e))
+
+    // Order loads before the fence ahead of later accesses (Acquire), or 
+    // earlier accesses ahead of stores after the fence (Release)
+    #if defined(_M_IX86) || defined(_M_X64)
+        #define ATOMIC_FenceAcquire()           _ReadWriteBarrier()
+        #define ATOMIC_FenceRelease()           _ReadWriteBarrier()
+    #else
+        #define ATOMIC_FenceAcquire()           MemoryBarrier()
+        #define ATOMIC_FenceRelease()           MemoryBarrier()
+    #endif
+
+    // Spin-wait hint and voluntary processor yield
+    #define ATOMIC_Pause()                      YieldProcessor()
+    #define ATOMIC_Yield()                      ((void)SwitchToThread())
+#else
+    #include <sched.h>
+
+    #define ATOMIC_Load32(p)                    __atomic_load_n((p), __ATOMIC_SEQ_CST)
+    #define ATOMIC_Store32(p, v)                __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+    #define ATOMIC_Exchange32(p, v)             __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+    #define ATOMIC_Add32(p, v)                  __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+    #define ATOMIC_CompareExchange32(p, e, d)   _ATOMIC_CompareExchange((p), (e), (d))
+    #define ATOMIC_StoreRelease32(p, v)         __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+    #define ATOMIC_LoadPtr(p)                   __atomic_load_n((p), __ATOMIC_SEQ_CST)
+    #define ATOMIC_StorePtr(p, v)               __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+    #define ATOMIC_ExchangePtr(p, v)            __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+    #define ATOMIC_CompareExchangePtr(p, e, d)  _ATOMIC_CompareExchange((p), (e), (d))
+
+    // __atomic_compare_exchange_n() writes the observed value back through the
+    // expected argument. The wrapper takes the expected value by copy so the
+    // macros above can be called with plain values.
+    #define _ATOMIC_CompareExchange(p, e, d) \
+        __extension__ ({ __typeof__(*(p) + 0) _expected_ = (e); \
+            __atomic_compare_exchange_n((p), &_expected_, (d), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); })
+
+    // Order loads before the fence ahead of later accesses (Acquire), or 
+    // earlier accesses ahead of stores after the fence (Release)
+    #define ATOMIC_FenceAcquire()               __atomic_thread_fence(__ATOMIC_ACQUIRE)
+    #define ATOMIC_FenceRelease()               __atomic_thread_fence(__ATOMIC_RELEASE)
+
+    // Spin-wait hint and voluntary processor yield
+    #if defined(__i386__) || defined(__x86_64__)
+        #define ATOMIC_Pause()                  __builtin_ia32_pause()
+    #else
+        #define ATOMIC_Pause()                  __atomic_signal_fence(__ATOMIC_SEQ_CST)
+    #endif
+    #define ATOMIC_Yield()                      ((void)sched_yield())
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ATOMIC_H
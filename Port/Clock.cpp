@@ -0,0 +1,31 @@
+#include "Clock.h"
+#include <chrono>
+
+static UINT64 CLK_SteadyClock(void);
+
+static CLK_SourceFuncType _sourceFunc = CLK_SteadyClock;
+
+//------------------------------------------------------------------------------
+// CLK_SteadyClock
+//------------------------------------------------------------------------------
+static UINT64 CLK_SteadyClock(void)
+{
+    using namespace std::chrono;
+    return (UINT64)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+//------------------------------------------------------------------------------
+// CLK_GetTimeNs
+//------------------------------------------------------------------------------
+UINT64 CLK_GetTimeNs(void)
+{
+    return _sourceFunc();
+}
+
+//------------------------------------------------------------------------------
+// CLK_SetSource
+//------------------------------------------------------------------------------
+void CLK_SetSource(CLK_SourceFuncType sourceFunc)
+{
+    _sourceFunc = sourceFunc ? sourceFunc : CLK_SteadyClock;
+}
@@ -0,0 +1,29 @@
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include "DataTypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A clock source returns a monotonic time in nanoseconds. The time must be
+// unaffected by wall clock changes and CPU load.
+typedef UINT64 (*CLK_SourceFuncType)(void);
+
+// Get the current monotonic time in nanoseconds from the clock source.
+UINT64 CLK_GetTimeNs(void);
+
+// Replace the clock source. NULL restores the default steady clock. Call 
+// once at startup before any thread reads the clock. The source must advance
+// at the rate of the steady clock, e.g. a hardware counter scaled to 
+// nanoseconds. The timer thread measures deadlines on this clock but sleeps
+// on the steady clock, so a source that runs faster than it (e.g. simulated
+// time) makes timers expire late.
+void CLK_SetSource(CLK_SourceFuncType sourceFunc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif 
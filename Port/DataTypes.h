@@ -16,6 +16,8 @@
 	typedef int INT;
 	typedef unsigned int UINT;
 	typedef unsigned long DWORD;
+	typedef unsigned long long UINT64;
+	typedef long long INT64;
 	typedef unsigned char BYTE;
 	typedef unsigned short WORD;
 	typedef float FLOAT;
@@ -0,0 +1,101 @@
+#include "MpscQueue.h"
+#include "Atomic.h"
+#include "Fault.h"
+
+//----------------------------------------------------------------------------
+// MPSC_Init
+//----------------------------------------------------------------------------
+void MPSC_Init(MPSC_Queue* self)
+{
+    ASSERT_TRUE(self);
+
+    self->stub.pNext = NULL;
+    self->pHead = &self->stub;
+    self->pTail = &self->stub;
+}
+
+//----------------------------------------------------------------------------
+// MPSC_Push
+//----------------------------------------------------------------------------
+void MPSC_Push(MPSC_Queue* self, MPSC_Node* node)
+{
+    MPSC_Node* prev;
+
+    ASSERT_TRUE(self);
+    ASSERT_TRUE(node);
+
+    ATOMIC_StorePtr(&node->pNext, NULL);
+
+    // Swing the head to the new node, then link the previous head to it.
+    // Between the two steps the consumer cannot see the new node.
+    prev = (MPSC_Node*)ATOMIC_ExchangePtr(&self->pHead, node);
+    ATOMIC_StorePtr(&prev->pNext, node);
+}
+
+//----------------------------------------------------------------------------
+// MPSC_PushChain
+//----------------------------------------------------------------------------
+void MPSC_PushChain(MPSC_Queue* self, MPSC_Node* first, MPSC_Node* last)
+{
+    MPSC_Node* prev;
+
+    ASSERT_TRUE(self);
+    ASSERT_TRUE(first);
+    ASSERT_TRUE(last);
+
+    ATOMIC_StorePtr(&last->pNext, NULL);
+
+    // Swing the head to the last node, then link the previous head to the
+    // first. The consumer sees the whole chain once the link is stored.
+    prev = (MPSC_Node*)ATOMIC_ExchangePtr(&self->pHead, last);
+    ATOMIC_StorePtr(&prev->pNext, first);
+}
+
+//----------------------------------------------------------------------------
+// MPSC_Pop
+//----------------------------------------------------------------------------
+MPSC_Node* MPSC_Pop(MPSC_Queue* self)
+{
+    MPSC_Node* tail;
+    MPSC_Node* next;
+
+    ASSERT_TRUE(self);
+
+    tail = self->pTail;
+    next = (MPSC_Node*)ATOMIC_LoadPtr(&tail->pNext);
+
+    // Skip over the stub node
+    if (tail == &self->stub)
+    {
+        // Queue empty or first push still in progress?
+        if (next == NULL)
+            return NULL;
+
+        self->pTail = next;
+        tail = next;
+        next = (MPSC_Node*)ATOMIC_LoadPtr(&next->pNext);
+    }
+
+    // More than one node queued. Remove the tail.
+    if (next)
+    {
+        self->pTail = next;
+        return tail;
+    }
+
+    // A producer has swung the head but not yet linked its node
+    if (tail != ATOMIC_LoadPtr(&self->pHead))
+        return NULL;
+
+    // Tail is the last node. Push the stub behind it so it can be removed.
+    MPSC_Push(self, &self->stub);
+
+    next = (MPSC_Node*)ATOMIC_LoadPtr(&tail->pNext);
+    if (next)
+    {
+        self->pTail = next;
+        return tail;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,51 @@
+// The MpscQueue module is an intrusive, unbounded, lock-free multiple
+// producer, single consumer FIFO queue (D. Vyukov algorithm).
+//
+// Any number of threads may call MPSC_Push() concurrently. Only one thread
+// may call MPSC_Pop(). Push is wait-free and never allocates; each queued
+// object embeds an MPSC_Node.
+//
+// MPSC_Pop() may return NULL while a push is still in progress on another
+// thread. That producer completes the push shortly after, so a consumer that
+// parks when MPSC_Pop() returns NULL must be woken by the producer after the
+// push returns.
+
+#ifndef _MPSC_QUEUE_H
+#define _MPSC_QUEUE_H
+
+#include "DataTypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct MPSC_Node
+{
+    struct MPSC_Node* volatile pNext;
+} MPSC_Node;
+
+typedef struct
+{
+    // Most recently pushed node. Written by producers.
+    MPSC_Node* volatile pHead;
+
+    // Oldest node. Accessed by the consumer only.
+    MPSC_Node* pTail;
+
+    // Placeholder node that keeps the list non-empty
+    MPSC_Node stub;
+} MPSC_Queue;
+
+void MPSC_Init(MPSC_Queue* self);
+void MPSC_Push(MPSC_Queue* self, MPSC_Node* node);
+
+// Push nodes already linked from first to last through pNext with one 
+// atomic exchange. The chain is popped in order.
+void MPSC_PushChain(MPSC_Queue* self, MPSC_Node* first, MPSC_Node* last);
+MPSC_Node* MPSC_Pop(MPSC_Queue* self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _MPSC_QUEUE_H
@@ -0,0 +1,67 @@
+#ifndef _SPIN_LOCK_H
+#define _SPIN_LOCK_H
+
+// A spin lock for very short critical sections. A SPIN_LOCK needs no create
+// or destroy call; static storage is zero initialized to unlocked, or use 
+// SPIN_LOCK_INIT. The lock is not recursive.
+//
+// A waiting thread spins briefly, then yields its time slice so a lock 
+// holder preempted on the same CPU can finish.
+
+#include "DataTypes.h"
+#include "Atomic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+    #define SPIN_INLINE static __inline
+#else
+    #define SPIN_INLINE static inline
+#endif
+
+// Spin iterations before yielding the CPU
+#define SPIN_LOCK_SPINS     64
+
+typedef struct
+{
+    volatile UINT32 locked;
+} SPIN_LOCK;
+
+#define SPIN_LOCK_INIT      { 0 }
+
+SPIN_INLINE BOOL SPIN_TryLock(SPIN_LOCK* lock)
+{
+    return ATOMIC_Exchange32(&lock->locked, 1) == 0;
+}
+
+SPIN_INLINE void SPIN_Lock(SPIN_LOCK* lock)
+{
+    while (!SPIN_TryLock(lock))
+    {
+        // Wait on a plain read so the cache line is not written while held
+        UINT spins = 0;
+        while (ATOMIC_Load32(&lock->locked))
+        {
+            if (++spins < SPIN_LOCK_SPINS)
+                ATOMIC_Pause();
+            else
+            {
+                ATOMIC_Yield();
+                spins = 0;
+            }
+        }
+    }
+}
+
+SPIN_INLINE void SPIN_Unlock(SPIN_LOCK* lock)
+{
+    ATOMIC_StoreRelease32(&lock->locked, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SPIN_LOCK_H
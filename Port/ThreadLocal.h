@@ -0,0 +1,13 @@
+#ifndef _THREAD_LOCAL_H
+#define _THREAD_LOCAL_H
+
+// Storage class for a variable with one instance per thread. Usable on 
+// static and global variables from both C and C++ source files.
+// e.g. static THREAD_LOCAL int myCount;
+#if defined(_MSC_VER)
+    #define THREAD_LOCAL    __declspec(thread)
+#else
+    #define THREAD_LOCAL    __thread
+#endif
+
+#endif // _THREAD_LOCAL_H
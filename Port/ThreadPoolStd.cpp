@@ -0,0 +1,212 @@
+#include "ThreadPoolStd.h"
+#include "Fault.h"
+#include "fb_allocator.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+using namespace std;
+
+// Pool and queue index of the calling pool thread
+static thread_local ThreadPool* t_pool = nullptr;
+static thread_local UINT t_index = 0;
+
+//----------------------------------------------------------------------------
+// ThreadPool
+//----------------------------------------------------------------------------
+ThreadPool::ThreadPool(const std::string& poolName) : m_count(0), m_next(0),
+	m_idle(0), m_wakeups(0), m_exit(false), POOL_NAME(poolName)
+{
+}
+
+//----------------------------------------------------------------------------
+// ~ThreadPool
+//----------------------------------------------------------------------------
+ThreadPool::~ThreadPool()
+{
+	ExitThreads();
+}
+
+//----------------------------------------------------------------------------
+// CreateThreads
+//----------------------------------------------------------------------------
+BOOL ThreadPool::CreateThreads(UINT count)
+{
+	if (!m_threads.empty())
+		return TRUE;
+
+	if (count == 0)
+		count = thread::hardware_concurrency();
+	if (count == 0)
+		count = 1;
+
+	m_queues.reset(new RunQueue[count]);
+	m_count = count;
+	m_exit = false;
+
+	for (UINT index = 0; index < count; index++)
+	{
+		thread* poolThread = new thread(&ThreadPool::Process, this, index);
+		string name = POOL_NAME + to_string(index);
+
+#ifdef WIN32
+		// Set the thread name so it shows in the Visual Studio Debug Location toolbar
+		std::wstring wstr(name.begin(), name.end());
+		SetThreadDescription(poolThread->native_handle(), wstr.c_str());
+#else
+		// Linux limits thread names to 15 characters
+		pthread_setname_np(poolThread->native_handle(), name.substr(0, 15).c_str());
+#endif
+		m_threads.push_back(poolThread);
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// ExitThreads
+//----------------------------------------------------------------------------
+void ThreadPool::ExitThreads()
+{
+	if (m_threads.empty())
+		return;
+
+	{
+		lock_guard<mutex> lk(m_mutex);
+		m_exit = true;
+	}
+	m_cv.notify_all();
+
+	for (thread* poolThread : m_threads)
+	{
+		poolThread->join();
+		delete poolThread;
+	}
+	m_threads.clear();
+	m_queues.reset();
+	m_count = 0;
+}
+
+//----------------------------------------------------------------------------
+// DispatchCallback
+//----------------------------------------------------------------------------
+void ThreadPool::DispatchCallback(const CB_CallbackMsg* msg)
+{
+	ASSERT_TRUE(m_count != 0);
+
+	// Keep work dispatched from a pool thread on that thread's queue
+	UINT index = (t_pool == this) ? t_index : (m_next++ % m_count);
+
+	// The queue node is reserved for the target OS task
+	Push(index, const_cast<CB_CallbackMsg*>(msg));
+
+	// Wake an idle thread to run or steal the message. A thread announces 
+	// it is idle before its final search, so either it finds this message or
+	// this thread sees it idle.
+	if (m_idle.load() > 0)
+	{
+		{
+			lock_guard<mutex> lk(m_mutex);
+			if (m_wakeups < m_idle.load())
+				m_wakeups++;
+		}
+		m_cv.notify_one();
+	}
+}
+
+//----------------------------------------------------------------------------
+// Push
+//----------------------------------------------------------------------------
+void ThreadPool::Push(UINT index, CB_CallbackMsg* msg)
+{
+	RunQueue& queue = m_queues[index];
+
+	msg->queueNode.pNext = NULL;
+
+	lock_guard<mutex> lk(queue.mutex);
+	if (queue.pTail)
+		queue.pTail->pNext = &msg->queueNode;
+	else
+		queue.pHead = &msg->queueNode;
+	queue.pTail = &msg->queueNode;
+}
+
+//----------------------------------------------------------------------------
+// Pop
+//----------------------------------------------------------------------------
+CB_CallbackMsg* ThreadPool::Pop(UINT index)
+{
+	RunQueue& queue = m_queues[index];
+	MPSC_Node* node;
+
+	lock_guard<mutex> lk(queue.mutex);
+	node = queue.pHead;
+	if (!node)
+		return NULL;
+
+	queue.pHead = node->pNext;
+	if (!queue.pHead)
+		queue.pTail = NULL;
+	return CB_GET_QUEUED_MSG(node);
+}
+
+//----------------------------------------------------------------------------
+// FindWork
+//----------------------------------------------------------------------------
+CB_CallbackMsg* ThreadPool::FindWork(UINT index)
+{
+	CB_CallbackMsg* msg = Pop(index);
+
+	// Own queue empty. Steal the oldest message from the next busy queue.
+	for (UINT victim = 1; !msg && victim < m_count; victim++)
+		msg = Pop((index + victim) % m_count);
+
+	return msg;
+}
+
+//----------------------------------------------------------------------------
+// Process
+//----------------------------------------------------------------------------
+void ThreadPool::Process(UINT index)
+{
+	t_pool = this;
+	t_index = index;
+
+	while (1)
+	{
+		CB_CallbackMsg* msg = FindWork(index);
+		if (!msg)
+		{
+			unique_lock<mutex> lk(m_mutex);
+
+			// Announce this thread is idle, then search again to catch a 
+			// message queued before the announcement was visible
+			m_idle++;
+			msg = FindWork(index);
+			if (!msg)
+			{
+				m_cv.wait(lk, [this] { return m_exit || m_wakeups > 0; });
+				if (m_wakeups > 0)
+					m_wakeups--;
+				else if (m_exit)
+				{
+					m_idle--;
+					break;
+				}
+			}
+			m_idle--;
+			if (!msg)
+				continue;
+		}
+
+		// Invoke the callback on the pool thread
+		CB_TargetInvoke(msg);
+	}
+
+	t_pool = nullptr;
+
+	// Return blocks cached by this thread to the shared allocators
+	ALLOC_FlushThreadCache();
+}
@@ -0,0 +1,87 @@
+#ifndef _THREAD_POOL_STD_H
+#define _THREAD_POOL_STD_H
+
+#include "callback.h"
+#include "DataTypes.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// A work-stealing pool of threads acting as one target OS task. Each pool 
+/// thread owns a run queue of callback messages. A message dispatched from a
+/// pool thread is queued on that thread's own queue; one dispatched from any
+/// other thread is spread round-robin. A pool thread with an empty queue 
+/// steals from the other queues before it parks.
+///
+/// Callbacks dispatched to the pool run concurrently and in no particular 
+/// order. An active object state machine bound to the pool is still run by 
+/// one thread at a time because its mailbox has at most one drain message
+/// in flight.
+class ThreadPool
+{
+public:
+	/// Constructor
+	ThreadPool(const std::string& poolName);
+
+	/// Destructor
+	~ThreadPool();
+
+	/// Called once to create the pool threads
+	/// @param[in] count - number of threads. 0 creates one per CPU.
+	/// @return TRUE if threads are created. FALSE otherise. 
+	BOOL CreateThreads(UINT count);
+
+	/// Called once a program exit to exit the pool threads. Queued callbacks
+	/// run before the threads exit.
+	void ExitThreads();
+
+	/// Get the number of pool threads
+	UINT GetThreadCount() const { return m_count; }
+
+	void DispatchCallback(const CB_CallbackMsg* msg);
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	// Intrusive FIFO of CB_CallbackMsg linked through queueNode. Each queue
+	// sits on its own cache line.
+	struct alignas(64) RunQueue
+	{
+		std::mutex mutex;
+		MPSC_Node* pHead = nullptr;
+		MPSC_Node* pTail = nullptr;
+	};
+
+	/// Entry point for each pool thread
+	void Process(UINT index);
+
+	void Push(UINT index, CB_CallbackMsg* msg);
+	CB_CallbackMsg* Pop(UINT index);
+
+	/// Get the next message from the thread's own queue or steal one
+	CB_CallbackMsg* FindWork(UINT index);
+
+	std::vector<std::thread*> m_threads;
+	std::unique_ptr<RunQueue[]> m_queues;
+	UINT m_count;
+
+	// Next queue for messages dispatched from outside the pool
+	std::atomic<UINT32> m_next;
+
+	// Parking lot. m_wakeups counts pending wakeups, at most one per idle
+	// thread.
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::atomic<UINT32> m_idle;
+	UINT32 m_wakeups;
+	bool m_exit;
+
+	const std::string POOL_NAME;
+};
+
+#endif 
@@ -1,25 +1,73 @@
 #include "Timer.h"
 #include "Fault.h"
 #include "LockGuard.h"
-#include <time.h>
+#include "Clock.h"
+#include "fb_allocator.h"
 
-typedef struct
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Running timers are held in a hierarchical timing wheel. A level 0 slot
+// spans one tick and a slot on each higher level spans a full rotation of
+// the level below. A timer is linked into the lowest level that reaches its
+// expiry and cascades down a level when the wheel enters its slot. Start,
+// stop and expiry are O(1). A bitmap of occupied slots per level finds the
+// next deadline without visiting idle slots.
+
+// Maximum number of timers. Define before compiling to override.
+#ifndef TMR_MAX_TIMERS
+#define TMR_MAX_TIMERS      1024
+#endif
+
+#define TMR_WHEEL_BITS      6
+#define TMR_WHEEL_SLOTS     (1 << TMR_WHEEL_BITS)
+#define TMR_WHEEL_MASK      (TMR_WHEEL_SLOTS - 1)
+#define TMR_WHEEL_LEVELS    8
+
+// Number of ticks the wheel spans (about 8.9 years). Longer timeouts are rejected.
+#define TMR_WHEEL_RANGE     ((TMR_Tick)1 << (TMR_WHEEL_BITS * TMR_WHEEL_LEVELS))
+
+// Most timers searched in a slot for the earliest expiry
+#define TMR_SCAN_LIMIT      16
+
+// Buckets in the TMR_Start() callback lookup table. Must be a power of 2.
+#define TMR_HASH_SIZE       64
+
+// Wheel time in ticks of one microsecond. Compare using TMR_BEFORE.
+typedef UINT64 TMR_Tick;
+#define TMR_BEFORE(a, b)    ((INT64)((TMR_Tick)(a) - (TMR_Tick)(b)) < 0)
+
+#define TMR_NSEC_PER_TICK   1000
+
+typedef struct TMR_Obj
 {
-    INT cbIdx;              // Callback array index
-    DWORD timeout;	    	// in ticks
-    DWORD expireTime;		// in ticks
-    BOOL enabled;           // TRUE if timer enabled
+    struct TMR_Obj* pNext;      // Next timer in the wheel slot
+    struct TMR_Obj* pPrev;      // Previous timer in the wheel slot
+    struct TMR_Obj* pHashNext;  // Next timer in the TMR_Start() lookup bucket
+    CB_Info cbInfo;             // Callback invoked on each expiry
+    TMR_Tick timeout;           // Period in ticks
+    TMR_Tick expireTime;        // Next expiry in ticks
+    BYTE level;                 // Wheel level while running
+    BYTE slot;                  // Wheel slot while running
+    BOOL running;               // TRUE if linked into the wheel
+    BOOL hashed;                // TRUE if created by TMR_Start()
 } TMR_Obj;
 
-// Maximum number of active timers
-#define MAX_TIMERS  5
+ALLOC_DEFINE(tmrAllocator, sizeof(TMR_Obj), TMR_MAX_TIMERS)
 
-static TMR_Obj timerObjs[MAX_TIMERS]; // One TMR_Obj per callback
-static LOCK_HANDLE _hLock;
+static TMR_Obj* _wheel[TMR_WHEEL_LEVELS][TMR_WHEEL_SLOTS];
+static UINT64 _occupied[TMR_WHEEL_LEVELS];  // Bit set for each non-empty slot
+static TMR_Tick _wheelTime;                 // Next tick to process
+static UINT32 _running;                     // Number of running timers
+
+// Expiry the timer thread is sleeping until, if _deadlineSet
+static TMR_Tick _deadline;
+static BOOL _deadlineSet;
 
-// Create async callbacks
-CB_DECLARE(TMR_ExpiredCb, const void*)
-CB_DEFINE(TMR_ExpiredCb, const void*, 0, MAX_TIMERS)
+static TMR_Obj* _hashTable[TMR_HASH_SIZE];
+static LOCK_HANDLE _hLock;
+static TMR_WakeupFuncType _wakeupFunc;
 
 void TMR_Init(void)
 {
@@ -31,123 +79,479 @@ void TMR_Term(void)
     LK_DESTROY(_hLock);
 }
 
-BOOL TMR_Start(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, DWORD timeout)
+void TMR_SetWakeup(TMR_WakeupFuncType wakeupFunc)
 {
-    BOOL success = FALSE;
+    _wakeupFunc = wakeupFunc;
+}
 
-    LK_LOCK(_hLock);
+// Get the current time in ticks
+static TMR_Tick TMR_Now(void)
+{
+    return CLK_GetTimeNs() / TMR_NSEC_PER_TICK;
+}
+
+// Get the index of the lowest set bit. bits must be non-zero.
+static UINT TMR_FirstSet(UINT64 bits)
+{
+#if defined(_MSC_VER)
+    unsigned long idx;
+    if (_BitScanForward(&idx, (unsigned long)bits))
+        return idx;
+    _BitScanForward(&idx, (unsigned long)(bits >> 32));
+    return idx + 32;
+#else
+    return (UINT)__builtin_ctzll(bits);
+#endif
+}
+
+// Rotate a slot bitmap so that bit 0 represents slot first
+static UINT64 TMR_Rotate(UINT64 bits, UINT first)
+{
+    return first ? (bits >> first) | (bits << (TMR_WHEEL_SLOTS - first)) : bits;
+}
 
-    BOOL registerSuccess = CB_Register(TMR_ExpiredCb, cbFunc, cbDispatchFunc, NULL);
-    if (registerSuccess)
+// Link a timer into the wheel according to its expiry. Lock must be held.
+static void TMR_Link(TMR_Obj* timer)
+{
+    TMR_Tick delta;
+    UINT level = 0;
+    UINT slot;
+
+    // An expiry already passed is processed on the next wheel tick
+    if (TMR_BEFORE(timer->expireTime, _wheelTime))
+        timer->expireTime = _wheelTime;
+
+    delta = timer->expireTime - _wheelTime;
+    if (delta >= TMR_WHEEL_RANGE)
     {
-        // Search for the registered data within the array
-        for (size_t idx = 0; idx < MAX_TIMERS; idx++)
+        delta = TMR_WHEEL_RANGE - 1;
+        timer->expireTime = _wheelTime + delta;
+    }
+
+    while (delta >= ((TMR_Tick)1 << (TMR_WHEEL_BITS * (level + 1))))
+        level++;
+    slot = (timer->expireTime >> (TMR_WHEEL_BITS * level)) & TMR_WHEEL_MASK;
+
+    timer->level = (BYTE)level;
+    timer->slot = (BYTE)slot;
+    timer->pPrev = NULL;
+    timer->pNext = _wheel[level][slot];
+    if (timer->pNext)
+        timer->pNext->pPrev = timer;
+    _wheel[level][slot] = timer;
+    _occupied[level] |= (UINT64)1 << slot;
+}
+
+// Unlink a timer from its wheel slot. Lock must be held.
+static void TMR_Unlink(TMR_Obj* timer)
+{
+    if (timer->pPrev)
+        timer->pPrev->pNext = timer->pNext;
+    else
+    {
+        _wheel[timer->level][timer->slot] = timer->pNext;
+        if (!timer->pNext)
+            _occupied[timer->level] &= ~((UINT64)1 << timer->slot);
+    }
+    if (timer->pNext)
+        timer->pNext->pPrev = timer->pPrev;
+}
+
+// Detach and return the timer list of a slot. Lock must be held.
+static TMR_Obj* TMR_TakeSlot(UINT level, UINT slot)
+{
+    TMR_Obj* list = _wheel[level][slot];
+    _wheel[level][slot] = NULL;
+    _occupied[level] &= ~((UINT64)1 << slot);
+    return list;
+}
+
+// Get the tick the wheel next reaches an occupied slot on a level. Lock must
+// be held. Returns FALSE if the level is empty.
+static BOOL TMR_GetLevelEvent(UINT level, TMR_Tick* event, UINT* slot)
+{
+    UINT shift = TMR_WHEEL_BITS * level;
+    TMR_Tick slotStart = (_wheelTime >> shift) << shift;
+    UINT current = (_wheelTime >> shift) & TMR_WHEEL_MASK;
+    UINT first;
+    UINT offset;
+
+    if (_occupied[level] == 0)
+        return FALSE;
+
+    // The current slot was cascaded when the wheel entered it. Unless the
+    // wheel is still on the slot's first tick, timers linked there since
+    // are a full rotation away.
+    first = (_wheelTime == slotStart) ? current : current + 1;
+    offset = TMR_FirstSet(TMR_Rotate(_occupied[level], first & TMR_WHEEL_MASK));
+
+    *event = slotStart + ((TMR_Tick)(first - current + offset) << shift);
+    *slot = (first + offset) & TMR_WHEEL_MASK;
+    return TRUE;
+}
+
+// Get the earliest tick any level needs processing. Lock must be held.
+static BOOL TMR_GetNextEvent(TMR_Tick* next)
+{
+    BOOL found = FALSE;
+    TMR_Tick event;
+    UINT slot;
+
+    for (UINT level = 0; level < TMR_WHEEL_LEVELS; level++)
+    {
+        if (TMR_GetLevelEvent(level, &event, &slot) &&
+            (!found || TMR_BEFORE(event, *next)))
+        {
+            *next = event;
+            found = TRUE;
+        }
+    }
+    return found;
+}
+
+// Get the earliest expiry of all running timers. Lock must be held.
+static BOOL TMR_GetNextExpiry(TMR_Tick* next)
+{
+    BOOL found = FALSE;
+    TMR_Tick event;
+    UINT slot;
+
+    for (UINT level = 0; level < TMR_WHEEL_LEVELS; level++)
+    {
+        if (!TMR_GetLevelEvent(level, &event, &slot))
+            continue;
+
+        // The next slot on a higher level holds the level's earliest
+        // expiries. Search a short slot so the timer thread wakes for the
+        // expiry itself; a crowded slot costs one wakeup for the cascade.
+        if (level > 0)
         {
-            // Get pointer to the CB_Info element within the multicast callback array 
-            // created by CB_DEFINE macro
-            const CB_Info* info = CB_GetCbInfo(TMR_ExpiredCb, idx);
-            ASSERT_TRUE(info != NULL);
-
-            // Does caller's callback match?
-            if (info->cbFunc == cbFunc &&
-                info->cbDispatchFunc == cbDispatchFunc)
+            const TMR_Obj* timer = _wheel[level][slot];
+            TMR_Tick earliest = timer->expireTime;
+            UINT count = 1;
+
+            for (timer = timer->pNext; timer && count < TMR_SCAN_LIMIT; timer = timer->pNext, count++)
             {
-                // Ensure we are not overwriting an enabled timer
-                ASSERT_TRUE(timerObjs[idx].enabled == FALSE);
-
-                // Save timer data into array at same index as callback
-                timerObjs[idx].timeout = timeout;
-                timerObjs[idx].expireTime = timeout;
-                timerObjs[idx].cbIdx = idx;
-                timerObjs[idx].enabled = TRUE;
-                success = TRUE;
-                break;
+                if (TMR_BEFORE(timer->expireTime, earliest))
+                    earliest = timer->expireTime;
             }
+            if (timer == NULL)
+                event = earliest;
+        }
+
+        if (!found || TMR_BEFORE(event, *next))
+        {
+            *next = event;
+            found = TRUE;
         }
     }
+    return found;
+}
 
-    LK_UNLOCK(_hLock);
+// Move timers from the higher level slots the wheel is entering down to
+// lower levels. Lock must be held.
+static void TMR_Cascade(void)
+{
+    for (UINT level = TMR_WHEEL_LEVELS - 1; level > 0; level--)
+    {
+        UINT shift = TMR_WHEEL_BITS * level;
+        TMR_Obj* list;
 
-    return success;
+        // Is the wheel entering a new slot on this level?
+        if (_wheelTime & (((TMR_Tick)1 << shift) - 1))
+            continue;
+
+        list = TMR_TakeSlot(level, (_wheelTime >> shift) & TMR_WHEEL_MASK);
+        while (list)
+        {
+            TMR_Obj* timer = list;
+            list = timer->pNext;
+            TMR_Link(timer);
+        }
+    }
 }
 
-void TMR_Stop(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc)
+// Dispatch the timers expiring on the current tick. Lock must be held.
+static void TMR_Expire(TMR_Tick now)
 {
-    LK_LOCK(_hLock);
+    TMR_Obj* list = TMR_TakeSlot(0, _wheelTime & TMR_WHEEL_MASK);
 
-    // Search for the registered data within the array
-    for (size_t idx = 0; idx < MAX_TIMERS; idx++)
+    while (list)
     {
-        // Get pointer to CB_Info element within the multicast callback array 
-        // created by CB_DEFINE macro
-        const CB_Info* info = CB_GetCbInfo(TMR_ExpiredCb, idx);
-        ASSERT_TRUE(info != NULL);
+        TMR_Obj* timer = list;
+        list = timer->pNext;
 
-        // Does caller's callback match?
-        if (info->cbFunc == cbFunc &&
-            info->cbDispatchFunc == cbDispatchFunc)
+        // Increment the timer to the next expiration
+        timer->expireTime += timer->timeout;
+
+        // Is the timer already expired after we incremented above?
+        if (!TMR_BEFORE(now, timer->expireTime))
         {
-            timerObjs[idx].enabled = FALSE;
-            break;
+            // The timer has fallen behind so set time expiration further forward.
+            timer->expireTime = now + timer->timeout;
         }
+        TMR_Link(timer);
+
+        // Call the client's expired callback function asynchronously.
+        // Typically don't call _CB_Dispatch directly, but in this case
+        // we want to dispatch one callback that expired; not all timer
+        // callbacks.
+        _CB_Dispatch(&timer->cbInfo, 1, NULL, NULL, 0);
+    }
+}
+
+// Start or restart a timer. Lock must be held. Returns TRUE if the timer
+// thread must be woken to honor the new expiry.
+static BOOL TMR_Arm(TMR_Obj* timer, UINT64 timeoutUs)
+{
+    // Round the start time up so a partial tick never shortens the timeout
+    TMR_Tick now = (CLK_GetTimeNs() + TMR_NSEC_PER_TICK - 1) / TMR_NSEC_PER_TICK;
+
+    if (timer->running)
+        TMR_Unlink(timer);
+    else
+    {
+        // Bring an idle wheel up to date before linking into it
+        if (_running++ == 0)
+            _wheelTime = now;
+        timer->running = TRUE;
     }
 
-    CB_Unregister(TMR_ExpiredCb, cbFunc, cbDispatchFunc);
+    // A zero timeout expires on the next tick
+    timer->timeout = (timeoutUs > 0) ? timeoutUs : 1;
+    timer->expireTime = now + timer->timeout;
+    TMR_Link(timer);
+
+    // Does the new timer expire before the timer thread wakes?
+    return !_deadlineSet || TMR_BEFORE(timer->expireTime, _deadline);
+}
+
+// Stop a timer. Lock must be held.
+static void TMR_Disarm(TMR_Obj* timer)
+{
+    if (!timer->running)
+        return;
+
+    TMR_Unlink(timer);
+    timer->running = FALSE;
+    _running--;
+}
 
+static TMR_Obj* TMR_Alloc(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, void* cbUserData)
+{
+    TMR_Obj* timer = (TMR_Obj*)ALLOC_Alloc(tmrAllocator, sizeof(TMR_Obj));
+    if (timer)
+    {
+        timer->pNext = NULL;
+        timer->pPrev = NULL;
+        timer->pHashNext = NULL;
+        timer->cbInfo.cbFunc = cbFunc;
+        timer->cbInfo.cbDispatchFunc = cbDispatchFunc;
+        timer->cbInfo.cbUserData = cbUserData;
+        timer->cbInfo.cbFlags = 0;
+        timer->timeout = 0;
+        timer->expireTime = 0;
+        timer->level = 0;
+        timer->slot = 0;
+        timer->running = FALSE;
+        timer->hashed = FALSE;
+    }
+    return timer;
+}
+
+static BOOL TMR_IsValidTimeout(UINT64 timeoutUs)
+{
+    return timeoutUs < TMR_WHEEL_RANGE;
+}
+
+TMR_HANDLE TMR_Create(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, void* cbUserData)
+{
+    TMR_Obj* timer;
+
+    ASSERT_TRUE(cbFunc != NULL);
+
+    LK_LOCK(_hLock);
+    timer = TMR_Alloc(cbFunc, cbDispatchFunc, cbUserData);
     LK_UNLOCK(_hLock);
+
+    return timer;
 }
 
-static DWORD TMR_Difference(DWORD time1, DWORD time2)
+void TMR_Delete(TMR_HANDLE hTimer)
 {
-    return (time2 - time1);
+    TMR_Obj* timer = (TMR_Obj*)hTimer;
+
+    ASSERT_TRUE(timer != NULL);
+    ASSERT_TRUE(timer->hashed == FALSE);
+
+    LK_LOCK(_hLock);
+    TMR_Disarm(timer);
+    ALLOC_Free(tmrAllocator, timer);
+    LK_UNLOCK(_hLock);
 }
 
-static void TMR_CheckExpired(TMR_Obj* timer)
+BOOL TMR_StartTimer(TMR_HANDLE hTimer, UINT64 timeoutUs)
 {
+    TMR_Obj* timer = (TMR_Obj*)hTimer;
+    BOOL wakeup;
+
     ASSERT_TRUE(timer != NULL);
 
-    if (!timer->enabled)
-        return;
+    if (!TMR_IsValidTimeout(timeoutUs))
+        return FALSE;
 
-    // Has the timer expired?
-    if (TMR_Difference(timer->expireTime, clock()) < timer->timeout)
-        return;
+    LK_LOCK(_hLock);
+    wakeup = TMR_Arm(timer, timeoutUs);
+    LK_UNLOCK(_hLock);
+
+    // Wake the timer thread to shorten its sleep
+    if (wakeup && _wakeupFunc)
+        _wakeupFunc();
+
+    return TRUE;
+}
+
+void TMR_StopTimer(TMR_HANDLE hTimer)
+{
+    TMR_Obj* timer = (TMR_Obj*)hTimer;
+
+    ASSERT_TRUE(timer != NULL);
+
+    LK_LOCK(_hLock);
+    TMR_Disarm(timer);
+    LK_UNLOCK(_hLock);
+}
+
+BOOL TMR_IsRunning(TMR_HANDLE hTimer)
+{
+    TMR_Obj* timer = (TMR_Obj*)hTimer;
+    BOOL running;
+
+    ASSERT_TRUE(timer != NULL);
+
+    LK_LOCK(_hLock);
+    running = timer->running;
+    LK_UNLOCK(_hLock);
+
+    return running;
+}
+
+// Get the TMR_Start() lookup bucket for a callback
+static TMR_Obj** TMR_GetBucket(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc)
+{
+    size_t key = (size_t)cbFunc ^ ((size_t)cbDispatchFunc * 31);
+    key ^= key >> 11;
+    return &_hashTable[(key >> 3) & (TMR_HASH_SIZE - 1)];
+}
+
+// Find the TMR_Start() timer for a callback. Lock must be held.
+static TMR_Obj** TMR_Find(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc)
+{
+    TMR_Obj** link = TMR_GetBucket(cbFunc, cbDispatchFunc);
+
+    while (*link)
+    {
+        // Does caller's callback match?
+        if ((*link)->cbInfo.cbFunc == cbFunc &&
+            (*link)->cbInfo.cbDispatchFunc == cbDispatchFunc)
+            break;
+        link = &(*link)->pHashNext;
+    }
+    return link;
+}
+
+BOOL TMR_Start(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, UINT64 timeoutUs)
+{
+    BOOL success = FALSE;
+    BOOL wakeup = FALSE;
+    TMR_Obj** link;
+
+    if (!TMR_IsValidTimeout(timeoutUs))
+        return FALSE;
 
-    // Increment the timer to the next expiration
-    timer->expireTime += timer->timeout;
+    LK_LOCK(_hLock);
 
-    // Is the timer already expired after we incremented above?
-    if (TMR_Difference(timer->expireTime, clock()) > timer->timeout)
+    link = TMR_Find(cbFunc, cbDispatchFunc);
+    if (*link == NULL)
     {
-        // The timer has fallen behind so set time expiration further forward.
-        timer->expireTime = clock();
+        *link = TMR_Alloc(cbFunc, cbDispatchFunc, NULL);
+        if (*link)
+            (*link)->hashed = TRUE;
     }
 
-    // Ensure index is within range
-    ASSERT_TRUE(timer->cbIdx < MAX_TIMERS);
+    if (*link)
+    {
+        wakeup = TMR_Arm(*link, timeoutUs);
+        success = TRUE;
+    }
+
+    LK_UNLOCK(_hLock);
+
+    // Wake the timer thread to shorten its sleep
+    if (wakeup && _wakeupFunc)
+        _wakeupFunc();
+
+    return success;
+}
+
+void TMR_Stop(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc)
+{
+    TMR_Obj** link;
 
-    // Get pointer to CB_Info element within the multicast callback array 
-    // created by CB_DEFINE macro
-    const CB_Info* info = CB_GetCbInfo(TMR_ExpiredCb, timer->cbIdx);
-    ASSERT_TRUE(info != NULL);
+    LK_LOCK(_hLock);
 
-    // Call the client's expired callback function asynchronously.
-    // Typically don't call _CB_Dispatch directly, but in this case
-    // we want to dispatch one callback that expired; not all timer 
-    // callbacks.
-    _CB_Dispatch(info, 1, NULL, 0);
+    link = TMR_Find(cbFunc, cbDispatchFunc);
+    if (*link)
+    {
+        TMR_Obj* timer = *link;
+        *link = timer->pHashNext;
+        TMR_Disarm(timer);
+        ALLOC_Free(tmrAllocator, timer);
+    }
+
+    LK_UNLOCK(_hLock);
 }
 
 void TMR_ProcessTimers()
 {
+    TMR_Tick now;
+    TMR_Tick event;
+
     LK_LOCK(_hLock);
 
-    // Iterate through each timer and check for expirations
-    for (size_t idx = 0; idx < MAX_TIMERS; idx++)
+    now = TMR_Now();
+
+    // Step the wheel through each tick up to now that has work to do
+    while (TMR_GetNextEvent(&event) && !TMR_BEFORE(now, event))
     {
-        TMR_CheckExpired(&timerObjs[idx]);
+        _wheelTime = event;
+        TMR_Cascade();
+        TMR_Expire(now);
+        _wheelTime++;
     }
 
+    // No work remains up to now. Skip the idle ticks.
+    if (TMR_BEFORE(_wheelTime, now + 1))
+        _wheelTime = now + 1;
+
     LK_UNLOCK(_hLock);
 }
 
+UINT64 TMR_GetNextTimeout()
+{
+    UINT64 timeout = TMR_INFINITE;
+    TMR_Tick now;
+
+    LK_LOCK(_hLock);
+
+    now = TMR_Now();
+
+    _deadlineSet = TMR_GetNextExpiry(&_deadline);
+    if (_deadlineSet)
+        timeout = TMR_BEFORE(now, _deadline) ? _deadline - now : 0;
+
+    LK_UNLOCK(_hLock);
+
+    return timeout;
+}
+
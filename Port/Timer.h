@@ -7,14 +7,51 @@
 extern "C" {
 #endif
 
+// Returned by TMR_GetNextTimeout() when no timer is running
+#define TMR_INFINITE    ((UINT64)-1)
+
+// Convert milliseconds or seconds to a microsecond timeout
+#define TMR_MSEC(_ms_)  ((UINT64)(_ms_) * 1000)
+#define TMR_SEC(_s_)    ((UINT64)(_s_) * 1000000)
+
+typedef void* TMR_HANDLE;
+
+// Called when a timer is started that expires before all running timers
+typedef void (*TMR_WakeupFuncType)(void);
+
 void TMR_Init();
 void TMR_Term();
-BOOL TMR_Start(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, DWORD timeout);
+
+// Create a timer that invokes cbFunc on the cbDispatchFunc task each time it
+// expires. A NULL cbDispatchFunc invokes cbFunc on the timer thread with the
+// timer lock held; such a callback must not call TMR functions. Returns NULL
+// if all timers are in use.
+TMR_HANDLE TMR_Create(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, void* cbUserData);
+void TMR_Delete(TMR_HANDLE hTimer);
+
+// Start or restart a periodic timer. timeoutUs is in microseconds. Timers
+// never expire early; expiry is measured on the CLK_GetTimeNs() clock. A 
+// timeoutUs of 0 expires on the next 1 microsecond tick. Returns FALSE if 
+// timeoutUs is 2^48 microseconds (about 8.9 years) or more.
+BOOL TMR_StartTimer(TMR_HANDLE hTimer, UINT64 timeoutUs);
+void TMR_StopTimer(TMR_HANDLE hTimer);
+BOOL TMR_IsRunning(TMR_HANDLE hTimer);
+
+// Start a periodic timer identified by its callback. timeoutUs is in 
+// microseconds and limited as for TMR_StartTimer().
+BOOL TMR_Start(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc, UINT64 timeoutUs);
 void TMR_Stop(CB_CallbackFuncType cbFunc, CB_DispatchCallbackFuncType cbDispatchFunc);
 
-// Called periodically by a thread to process all timers
+// Called by a timer thread to process expired timers
 void TMR_ProcessTimers();
 
+// Get microseconds until the earliest running timer expires, or TMR_INFINITE.
+// A timer thread sleeps this long before calling TMR_ProcessTimers().
+UINT64 TMR_GetNextTimeout();
+
+// Set the function called to wake the timer thread when a sooner timer starts
+void TMR_SetWakeup(TMR_WakeupFuncType wakeupFunc);
+
 #ifdef __cplusplus
 }
 #endif
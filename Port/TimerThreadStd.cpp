@@ -0,0 +1,119 @@
+#include "TimerThreadStd.h"
+#include "Timer.h"
+#include "fb_allocator.h"
+#include <chrono>
+
+#ifdef WIN32
+#include <Windows.h>
+#endif
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+// TimerThread
+//----------------------------------------------------------------------------
+TimerThread::TimerThread(const std::string& threadName) : m_thread(0), m_wakeups(0), 
+	m_exit(false), THREAD_NAME(threadName)
+{
+}
+
+//----------------------------------------------------------------------------
+// ~TimerThread
+//----------------------------------------------------------------------------
+TimerThread::~TimerThread()
+{
+	ExitThread();
+}
+
+//----------------------------------------------------------------------------
+// CreateThread
+//----------------------------------------------------------------------------
+BOOL TimerThread::CreateThread()
+{
+	if (!m_thread)
+	{
+		m_exit = false;
+		m_thread = new thread(&TimerThread::Process, this);
+
+#ifdef WIN32
+		// Set the thread name so it shows in the Visual Studio Debug Location toolbar
+		std::wstring wstr(THREAD_NAME.begin(), THREAD_NAME.end());
+		SetThreadDescription(m_thread->native_handle(), wstr.c_str());
+#endif
+	}
+	return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// ExitThread
+//----------------------------------------------------------------------------
+void TimerThread::ExitThread()
+{
+	if (!m_thread)
+		return;
+
+	{
+		lock_guard<mutex> lk(m_mutex);
+		m_exit = true;
+	}
+	m_cv.notify_one();
+
+	m_thread->join();
+	delete m_thread;
+	m_thread = 0;
+}
+
+//----------------------------------------------------------------------------
+// Wakeup
+//----------------------------------------------------------------------------
+void TimerThread::Wakeup()
+{
+	{
+		lock_guard<mutex> lk(m_mutex);
+		m_wakeups++;
+	}
+	m_cv.notify_one();
+}
+
+//----------------------------------------------------------------------------
+// Process
+//----------------------------------------------------------------------------
+void TimerThread::Process()
+{
+	unique_lock<mutex> lk(m_mutex);
+
+	while (!m_exit)
+	{
+		// Sample the wakeup count before reading the next deadline so a 
+		// timer started in between is not missed
+		UINT32 wakeups = m_wakeups;
+		lk.unlock();
+
+		UINT64 timeout = TMR_GetNextTimeout();
+
+		lk.lock();
+		auto woken = [&] { return m_exit || m_wakeups != wakeups; };
+
+		// Sleep until the earliest deadline. No timers running? Sleep until woken.
+		// The timeout is measured on CLK_GetTimeNs(), which CLK_SetSource() 
+		// requires to advance at the steady clock's rate. Waking a little 
+		// early is harmless; no timer has expired and the loop sleeps again.
+		if (timeout == TMR_INFINITE)
+			m_cv.wait(lk, woken);
+		else if (timeout > 0 && m_cv.wait_until(lk, 
+			chrono::steady_clock::now() + chrono::microseconds(timeout), woken))
+			continue;
+
+		if (m_exit)
+			break;
+
+		// Expired timers dispatch their callbacks to each timer's target thread
+		lk.unlock();
+		TMR_ProcessTimers();
+		lk.lock();
+	}
+	lk.unlock();
+
+	// Return blocks cached by this thread to the shared allocators
+	ALLOC_FlushThreadCache();
+}
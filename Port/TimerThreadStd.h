@@ -0,0 +1,52 @@
+#ifndef _TIMER_THREAD_STD_H
+#define _TIMER_THREAD_STD_H
+
+#include "DataTypes.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+
+/// One thread services all timers. It sleeps until the earliest timer 
+/// deadline and TMR_ProcessTimers() dispatches each expired timer's callback
+/// to the timer's own target thread.
+class TimerThread
+{
+public:
+	/// Constructor
+	TimerThread(const std::string& threadName);
+
+	/// Destructor
+	~TimerThread();
+
+	/// Called once to create the timer thread
+	/// @return TRUE if thread is created. FALSE otherise. 
+	BOOL CreateThread();
+
+	/// Called once a program exit to exit the timer thread
+	void ExitThread();
+
+	/// Wake the timer thread to recompute its deadline. Called when a timer
+	/// starts that expires before all running timers.
+	void Wakeup();
+
+private:
+	TimerThread(const TimerThread&);
+	TimerThread& operator=(const TimerThread&);
+
+	/// Entry point for the thread
+	void Process();
+
+	std::thread* m_thread;
+
+	// Signaled on Wakeup() or exit. m_wakeups counts signals so one sent
+	// while the deadline is computed is not lost.
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	UINT32 m_wakeups;
+	bool m_exit;
+
+	const std::string THREAD_NAME;
+};
+
+#endif 
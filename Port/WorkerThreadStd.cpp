@@ -1,28 +1,122 @@
 #include "WorkerThreadStd.h"
-#include "ThreadMsg.h"
+#include "TimerThreadStd.h"
+#include "ThreadPoolStd.h"
 #include "Timer.h"
 #include "Fault.h"
+#include "fb_allocator.h"
+#include <array>
+#include <utility>
 
 #ifdef WIN32
 #include <Windows.h>
+#else
+#include <pthread.h>
 #endif
 
 using namespace std;
 
-#define MSG_DISPATCH_DELEGATE	1
-#define MSG_EXIT_THREAD			2
-#define MSG_TIMER				3
+// Worker registry indexed by worker id. Written only by CreateThreadsEx() 
+// and ExitThreads() while no callbacks are being dispatched.
+static WorkerThread* workers[WORKER_MAX_THREADS];
+static UINT workerCount = 0;
 
-static WorkerThread workerThread1("Thread1");
-static WorkerThread workerThread2("Thread2");
+// Default workers created by CreateThreads()
+static const WorkerThreadConfig defaultConfig[] =
+{
+	{ "Thread1", WORKER_ANY_CPU },
+	{ "Thread2", WORKER_ANY_CPU }
+};
+
+// Single timer service thread shared by all worker threads
+static TimerThread timerThread("Timer");
+
+// Work-stealing pool created by CreateThreadPool()
+static ThreadPool threadPool("Pool");
+
+// C dispatch function bound to one worker id
+template <UINT ID>
+static BOOL DispatchCallbackWorker(const CB_CallbackMsg* cbMsg)
+{
+	return DispatchCallbackThread(ID, cbMsg);
+}
+
+// C chain dispatch function bound to one worker id
+template <UINT ID>
+static BOOL DispatchCallbackChainWorker(const CB_CallbackMsg* first, const CB_CallbackMsg* last)
+{
+	return DispatchCallbackChainThread(ID, first, last);
+}
+
+template <size_t... IDS>
+static constexpr std::array<CB_DispatchCallbackFuncType, sizeof...(IDS)> MakeDispatchTable(std::index_sequence<IDS...>)
+{
+	return { { &DispatchCallbackWorker<IDS>... } };
+}
+
+template <size_t... IDS>
+static constexpr std::array<CB_DispatchChainFuncType, sizeof...(IDS)> MakeChainTable(std::index_sequence<IDS...>)
+{
+	return { { &DispatchCallbackChainWorker<IDS>... } };
+}
+
+// One dispatch function per possible worker id
+static const std::array<CB_DispatchCallbackFuncType, WORKER_MAX_THREADS> dispatchTable = 
+	MakeDispatchTable(std::make_index_sequence<WORKER_MAX_THREADS>());
+
+// One chain dispatch function per possible worker id
+static const std::array<CB_DispatchChainFuncType, WORKER_MAX_THREADS> chainTable = 
+	MakeChainTable(std::make_index_sequence<WORKER_MAX_THREADS>());
+
+//----------------------------------------------------------------------------
+// TimerWakeup
+//----------------------------------------------------------------------------
+static void TimerWakeup(void)
+{
+	timerThread.Wakeup();
+}
 
 //----------------------------------------------------------------------------
 // CreateThreads
 //----------------------------------------------------------------------------
 extern "C" void CreateThreads(void)
 {
-    workerThread1.CreateThread();
-    workerThread2.CreateThread();
+	CreateThreadsEx(defaultConfig, sizeof(defaultConfig) / sizeof(defaultConfig[0]));
+}
+
+//----------------------------------------------------------------------------
+// CreateThreadsEx
+//----------------------------------------------------------------------------
+extern "C" void CreateThreadsEx(const WorkerThreadConfig* config, UINT count)
+{
+	ASSERT_TRUE(config != NULL);
+	ASSERT_TRUE(count <= WORKER_MAX_THREADS);
+	ASSERT_TRUE(workerCount == 0);
+
+	TMR_SetWakeup(TimerWakeup);
+
+	for (UINT id = 0; id < count; id++)
+	{
+		workers[id] = new WorkerThread(config[id].name ? config[id].name : "Worker", config[id].cpu);
+
+		// Identify the worker's dispatch functions for direct callbacks
+		workers[id]->AddDispatchFunc(dispatchTable[id]);
+		if (id == 0)
+			workers[id]->AddDispatchFunc(DispatchCallbackThread1);
+		else if (id == 1)
+			workers[id]->AddDispatchFunc(DispatchCallbackThread2);
+		workers[id]->CreateThread();
+
+		// Let publish batches queue a chain of messages to the worker at once
+		CB_SetChainDispatch(dispatchTable[id], chainTable[id]);
+	}
+	workerCount = count;
+
+	if (count > 0)
+		CB_SetChainDispatch(DispatchCallbackThread1, chainTable[0]);
+	if (count > 1)
+		CB_SetChainDispatch(DispatchCallbackThread2, chainTable[1]);
+
+	timerThread.CreateThread();
 }
 
 //----------------------------------------------------------------------------
@@ -30,8 +124,74 @@ extern "C" void CreateThreads(void)
 //----------------------------------------------------------------------------
 extern "C" void ExitThreads(void)
 {
-    workerThread1.ExitThread();
-    workerThread2.ExitThread();
+	// Stop expiries before the target threads exit
+	timerThread.ExitThread();
+	threadPool.ExitThreads();
+
+	for (UINT id = 0; id < workerCount; id++)
+	{
+		workers[id]->ExitThread();
+		delete workers[id];
+		workers[id] = NULL;
+	}
+	workerCount = 0;
+}
+
+//----------------------------------------------------------------------------
+// CreateThreadPool
+//----------------------------------------------------------------------------
+extern "C" void CreateThreadPool(UINT count)
+{
+	threadPool.CreateThreads(count);
+}
+
+//----------------------------------------------------------------------------
+// DispatchCallbackPool
+//----------------------------------------------------------------------------
+extern "C" BOOL DispatchCallbackPool(const CB_CallbackMsg* cbMsg)
+{
+	threadPool.DispatchCallback(cbMsg);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// GetWorkerThreadCount
+//----------------------------------------------------------------------------
+extern "C" UINT GetWorkerThreadCount(void)
+{
+	return workerCount;
+}
+
+//----------------------------------------------------------------------------
+// DispatchCallbackThread
+//----------------------------------------------------------------------------
+extern "C" BOOL DispatchCallbackThread(UINT id, const CB_CallbackMsg* cbMsg)
+{
+	ASSERT_TRUE(id < workerCount);
+
+	workers[id]->DispatchCallback(cbMsg);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// DispatchCallbackChainThread
+//----------------------------------------------------------------------------
+extern "C" BOOL DispatchCallbackChainThread(UINT id, const CB_CallbackMsg* first, const CB_CallbackMsg* last)
+{
+	ASSERT_TRUE(id < workerCount);
+
+	workers[id]->DispatchCallbackChain(first, last);
+	return TRUE;
+}
+
+//----------------------------------------------------------------------------
+// GetDispatchCallbackThread
+//----------------------------------------------------------------------------
+extern "C" CB_DispatchCallbackFuncType GetDispatchCallbackThread(UINT id)
+{
+	if (id >= WORKER_MAX_THREADS)
+		return NULL;
+	return dispatchTable[id];
 }
 
 //----------------------------------------------------------------------------
@@ -39,8 +199,7 @@ extern "C" void ExitThreads(void)
 //----------------------------------------------------------------------------
 extern "C" BOOL DispatchCallbackThread1(const CB_CallbackMsg* cbMsg)
 {
-    workerThread1.DispatchCallback(cbMsg);
-    return TRUE;
+	return DispatchCallbackThread(0, cbMsg);
 }
 
 //----------------------------------------------------------------------------
@@ -48,15 +207,21 @@ extern "C" BOOL DispatchCallbackThread1(const CB_CallbackMsg* cbMsg)
 //----------------------------------------------------------------------------
 extern "C" BOOL DispatchCallbackThread2(const CB_CallbackMsg* cbMsg)
 {
-    workerThread2.DispatchCallback(cbMsg);
-    return TRUE;
+	return DispatchCallbackThread(1, cbMsg);
 }
 
 //----------------------------------------------------------------------------
 // WorkerThread
 //----------------------------------------------------------------------------
-WorkerThread::WorkerThread(const std::string& threadName) : m_thread(0), m_timerExit(false), THREAD_NAME(threadName)
+WorkerThread::WorkerThread(const std::string& threadName, INT cpu) : m_thread(0), m_exit(false), 
+	m_sleeping(false), m_dispatchFuncCount(0), m_cpu(cpu), THREAD_NAME(threadName)
 {
+	MPSC_Init(&m_queue);
+
+	m_exitMsg = CB_CallbackMsg();
+	m_exitMsg.cbFunc = &WorkerThread::ExitCallback;
+	m_exitMsg.cbUserData = this;
+	m_exitMsg.cbFlags = CB_MSG_STATIC;
 }
 
 //----------------------------------------------------------------------------
@@ -67,6 +232,16 @@ WorkerThread::~WorkerThread()
 	ExitThread();
 }
 
+//----------------------------------------------------------------------------
+// AddDispatchFunc
+//----------------------------------------------------------------------------
+void WorkerThread::AddDispatchFunc(CB_DispatchCallbackFuncType dispatchFunc)
+{
+	ASSERT_TRUE(!m_thread);
+	ASSERT_TRUE(m_dispatchFuncCount < MAX_DISPATCH_FUNCS);
+	m_dispatchFuncs[m_dispatchFuncCount++] = dispatchFunc;
+}
+
 //----------------------------------------------------------------------------
 // CreateThread
 //----------------------------------------------------------------------------
@@ -87,6 +262,24 @@ BOOL WorkerThread::CreateThread()
 		{
 			// Handle error if needed
 		}
+
+		// Pin the thread to one CPU
+		if (m_cpu != WORKER_ANY_CPU)
+			SetThreadAffinityMask(handle, (DWORD_PTR)1 << m_cpu);
+#else
+		auto handle = m_thread->native_handle();
+
+		// Linux limits thread names to 15 characters
+		pthread_setname_np(handle, THREAD_NAME.substr(0, 15).c_str());
+
+		// Pin the thread to one CPU
+		if (m_cpu != WORKER_ANY_CPU)
+		{
+			cpu_set_t cpuSet;
+			CPU_ZERO(&cpuSet);
+			CPU_SET(m_cpu, &cpuSet);
+			pthread_setaffinity_np(handle, sizeof(cpuSet), &cpuSet);
+		}
 #endif
 	}
 	return TRUE;
@@ -117,15 +310,8 @@ void WorkerThread::ExitThread()
 	if (!m_thread)
 		return;
 
-	// Create a new ThreadMsg
-	ThreadMsg* threadMsg = new ThreadMsg(MSG_EXIT_THREAD, 0);
-
 	// Put exit thread message into the queue
-	{
-		lock_guard<mutex> lock(m_mutex);
-		m_queue.push(threadMsg);
-		m_cv.notify_one();
-	}
+	PostMsg(&m_exitMsg);
 
 	m_thread->join();
 	delete m_thread;
@@ -139,98 +325,123 @@ void WorkerThread::DispatchCallback(const CB_CallbackMsg* msg)
 {
 	ASSERT_TRUE(m_thread);
 
-	// Create a new ThreadMsg
-	ThreadMsg* threadMsg = new ThreadMsg(MSG_DISPATCH_DELEGATE, msg);
+	// Add callback msg to queue and notify worker thread. The message is
+	// linked through its own queue node; nothing is allocated.
+	PostMsg(msg);
+}
+
+//----------------------------------------------------------------------------
+// PostMsg
+//----------------------------------------------------------------------------
+void WorkerThread::PostMsg(const CB_CallbackMsg* msg)
+{
+	// The queue node is reserved for the target OS task
+	CB_CallbackMsg* queuedMsg = const_cast<CB_CallbackMsg*>(msg);
+
+	// Lock-free enqueue
+	MPSC_Push(&m_queue, &queuedMsg->queueNode);
 
-	// Add dispatch delegate msg to queue and notify worker thread
-	std::unique_lock<std::mutex> lk(m_mutex);
-	m_queue.push(threadMsg);
-	m_cv.notify_one();
+	Wakeup();
 }
 
 //----------------------------------------------------------------------------
-// TimerThread
+// DispatchCallbackChain
 //----------------------------------------------------------------------------
-void WorkerThread::TimerThread()
+void WorkerThread::DispatchCallbackChain(const CB_CallbackMsg* first, const CB_CallbackMsg* last)
 {
-    while (!m_timerExit)
-    {
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	ASSERT_TRUE(m_thread);
 
-        ThreadMsg* threadMsg = new ThreadMsg(MSG_TIMER, 0);
+	// The queue nodes are reserved for the target OS task
+	CB_CallbackMsg* queuedFirst = const_cast<CB_CallbackMsg*>(first);
+	CB_CallbackMsg* queuedLast = const_cast<CB_CallbackMsg*>(last);
 
-        // Add timer msg to queue and notify worker thread
-        std::unique_lock<std::mutex> lk(m_mutex);
-        m_queue.push(threadMsg);
-        m_cv.notify_one();
-    }
+	// Lock-free enqueue of the whole chain
+	MPSC_PushChain(&m_queue, &queuedFirst->queueNode, &queuedLast->queueNode);
+
+	Wakeup();
 }
 
 //----------------------------------------------------------------------------
-// Process
+// Wakeup
 //----------------------------------------------------------------------------
-void WorkerThread::Process()
+void WorkerThread::Wakeup()
 {
-    m_timerExit = false;
-    std::thread timerThread(&WorkerThread::TimerThread, this);
+	// Only take the lock and signal if the worker thread is parked. The 
+	// worker sets m_sleeping before its final queue check, so either it sees
+	// the pushed messages or this thread sees m_sleeping.
+	if (m_sleeping.load())
+	{
+		{
+			std::lock_guard<std::mutex> lk(m_mutex);
+			m_sleeping = false;
+		}
+		m_cv.notify_one();
+	}
+}
 
+//----------------------------------------------------------------------------
+// WaitMsg
+//----------------------------------------------------------------------------
+CB_CallbackMsg* WorkerThread::WaitMsg()
+{
 	while (1)
 	{
-		ThreadMsg* msg = 0;
+		MPSC_Node* node = MPSC_Pop(&m_queue);
+		if (node)
+			return CB_GET_QUEUED_MSG(node);
+
+		// Announce the worker is about to park, then check the queue again
+		// to catch a message pushed before the announcement was visible
+		m_sleeping = true;
+		node = MPSC_Pop(&m_queue);
+		if (node)
 		{
-			// Wait for a message to be added to the queue
-			std::unique_lock<std::mutex> lk(m_mutex);
-			while (m_queue.empty())
-				m_cv.wait(lk);
+			m_sleeping = false;
+			return CB_GET_QUEUED_MSG(node);
+		}
 
-			if (m_queue.empty())
-				continue;
+		// Park until a producer clears m_sleeping
+		std::unique_lock<std::mutex> lk(m_mutex);
+		m_cv.wait(lk, [this] { return !m_sleeping.load(); });
+	}
+}
 
-			msg = m_queue.front();
-			m_queue.pop();
-		}
+//----------------------------------------------------------------------------
+// ExitCallback
+//----------------------------------------------------------------------------
+void WorkerThread::ExitCallback(const void* data, void* userData)
+{
+	(void)data;
+	WorkerThread* self = static_cast<WorkerThread*>(userData);
+	self->m_exit = true;
+}
 
-		switch (msg->GetId())
-		{
-			case MSG_DISPATCH_DELEGATE:
-			{
-				ASSERT_TRUE(msg->GetData() != NULL);
-
-    			// Convert the ThreadMsg void* data back to a CB_CallbackMsg* 
-                const CB_CallbackMsg* callbackMsg = static_cast<const CB_CallbackMsg*>(msg->GetData());
-
-				// Invoke the callback on the target thread
-                CB_TargetInvoke(callbackMsg);
-
-				// Delete dynamic data passed through message queue
-				delete msg;
-				break;
-			}
-
-            case MSG_TIMER:
-                TMR_ProcessTimers();
-                delete msg;
-                break;
-
-			case MSG_EXIT_THREAD:
-			{
-                m_timerExit = true;
-                timerThread.join();
-
-				delete msg;
-				std::unique_lock<std::mutex> lk(m_mutex);
-				while (!m_queue.empty())
-				{
-					msg = m_queue.front();
-					m_queue.pop();
-					delete msg;
-				}
-				return;
-			}
-
-			default:
-				ASSERT();
-		}
+//----------------------------------------------------------------------------
+// Process
+//----------------------------------------------------------------------------
+void WorkerThread::Process()
+{
+	m_exit = false;
+
+	// Let callbacks published on this thread to this thread run directly
+	for (UINT idx = 0; idx < m_dispatchFuncCount; idx++)
+		CB_SetThreadDispatch(m_dispatchFuncs[idx]);
+
+	while (!m_exit)
+	{
+		// Wait for a message to be added to the queue
+		CB_CallbackMsg* msg = WaitMsg();
+
+		// Invoke the callback on the target thread
+		CB_TargetInvoke(msg);
 	}
+
+	// Release messages queued after the exit message
+	MPSC_Node* node;
+	while ((node = MPSC_Pop(&m_queue)) != NULL)
+		CB_DiscardMsg(CB_GET_QUEUED_MSG(node));
+
+	// Return blocks cached by this thread to the shared allocators
+	ALLOC_FlushThreadCache();
 }
 
@@ -6,29 +6,30 @@
 
 #include "callback.h"
 #include "DataTypes.h"
+#include "MpscQueue.h"
+#include "WorkerThreads.h"
 #include <thread>
-#include <queue>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
 #include <string>
 
-// C language interface to callback dispatch functions
-extern "C" void CreateThreads(void);
-extern "C" void ExitThreads(void);
-extern "C" BOOL DispatchCallbackThread1(const CB_CallbackMsg* cbMsg);
-extern "C" BOOL DispatchCallbackThread2(const CB_CallbackMsg* cbMsg);
-
-class ThreadMsg;
 
 class WorkerThread 
 {
 public:
 	/// Constructor
-	WorkerThread(const std::string& threadName);
+	/// @param[in] threadName - thread name shown by debuggers and OS tools
+	/// @param[in] cpu - CPU index to pin the thread to or WORKER_ANY_CPU
+	WorkerThread(const std::string& threadName, INT cpu = WORKER_ANY_CPU);
 
 	/// Destructor
-	~WorkerThread();
+	virtual ~WorkerThread();
+
+	/// Register a dispatch function that queues to this worker. Callbacks 
+	/// registered with CB_REG_DIRECT on it run directly when published on 
+	/// the worker thread. Call before CreateThread().
+	void AddDispatchFunc(CB_DispatchCallbackFuncType dispatchFunc);
 
 	/// Called once to create the worker thread
 	/// @return TRUE if thread is created. FALSE otherise. 
@@ -45,6 +46,10 @@ public:
 
 	virtual void DispatchCallback(const CB_CallbackMsg* msg);
 
+	/// Queue a chain of messages linked through CB_CallbackMsg::queueNode
+	/// with one queue operation and at most one wakeup
+	void DispatchCallbackChain(const CB_CallbackMsg* first, const CB_CallbackMsg* last);
+
 private:
 	WorkerThread(const WorkerThread&);
 	WorkerThread& operator=(const WorkerThread&);
@@ -52,14 +57,39 @@ private:
 	/// Entry point for the thread
 	void Process();
 
-    /// Entry point for timer thread
-    void TimerThread();
+	/// Add a message to the queue and wake the worker thread if parked
+	void PostMsg(const CB_CallbackMsg* msg);
+
+	/// Wake the worker thread if parked
+	void Wakeup();
+
+	/// Remove the next message from the queue. Parks the worker thread 
+	/// while the queue is empty.
+	CB_CallbackMsg* WaitMsg();
+
+	/// Static message callback executed on the worker thread
+	static void ExitCallback(const void* data, void* userData);
 
 	std::thread* m_thread;
-	std::queue<ThreadMsg*> m_queue;
+
+	// Queue of CB_CallbackMsg linked through CB_CallbackMsg::queueNode
+	MPSC_Queue m_queue;
+
+	// Exit message owned by the worker thread. Never heap allocated.
+	CB_CallbackMsg m_exitMsg;
+	bool m_exit;
+
+	// Parking lot used only while the worker thread is asleep
 	std::mutex m_mutex;
 	std::condition_variable m_cv;
-    std::atomic<bool> m_timerExit;
+	std::atomic<bool> m_sleeping;
+
+	// Dispatch functions that queue to this worker
+	static const UINT MAX_DISPATCH_FUNCS = 4;
+	CB_DispatchCallbackFuncType m_dispatchFuncs[MAX_DISPATCH_FUNCS];
+	UINT m_dispatchFuncCount;
+
+	const INT m_cpu;
 	const std::string THREAD_NAME;
 };
 
@@ -0,0 +1,75 @@
+#ifndef _WORKER_THREADS_H
+#define _WORKER_THREADS_H
+
+// C language interface to the worker thread registry. Each worker thread is 
+// a target OS task with its own callback dispatch function. Create the 
+// workers one time at startup with CreateThreads() or CreateThreadsEx().
+
+#include "callback.h"
+#include "DataTypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum number of worker threads. Define before compiling to override.
+#ifndef WORKER_MAX_THREADS
+#define WORKER_MAX_THREADS      16
+#endif
+
+// Pass as cpu to let the OS schedule the worker on any CPU
+#define WORKER_ANY_CPU          (-1)
+
+typedef struct
+{
+    // Thread name shown by debuggers and OS tools
+    const char* name;
+
+    // CPU index to pin the worker to, or WORKER_ANY_CPU
+    INT cpu;
+} WorkerThreadConfig;
+
+// Create the two default workers "Thread1" and "Thread2"
+void CreateThreads(void);
+
+// Create count workers described by config. Worker ids are the config 
+// array indices.
+void CreateThreadsEx(const WorkerThreadConfig* config, UINT count);
+
+// Create the shared work-stealing thread pool. count 0 creates one thread
+// per CPU. Call after CreateThreads() or CreateThreadsEx().
+void CreateThreadPool(UINT count);
+
+// Exit and destroy all workers and the thread pool
+void ExitThreads(void);
+
+// Get the number of created workers
+UINT GetWorkerThreadCount(void);
+
+// Dispatch a callback message to the worker with the given id
+BOOL DispatchCallbackThread(UINT id, const CB_CallbackMsg* cbMsg);
+
+// Dispatch a chain of callback messages, linked from first to last through
+// queueNode, to the worker with the given id. The worker is woken at most 
+// once. CB_BatchCommit() uses it through CB_SetChainDispatch().
+BOOL DispatchCallbackChainThread(UINT id, const CB_CallbackMsg* first, const CB_CallbackMsg* last);
+
+// Get the dispatch function of a worker to pass to CB_Register(), 
+// TMR_Create() and the like. Returns NULL if id is out of range.
+CB_DispatchCallbackFuncType GetDispatchCallbackThread(UINT id);
+
+// Dispatch a callback message to the thread pool. Any pool thread may run
+// it, concurrently with other pool callbacks. Bind active object state 
+// machines to the pool to spread many machines across the pool threads;
+// each machine still runs on one thread at a time.
+BOOL DispatchCallbackPool(const CB_CallbackMsg* cbMsg);
+
+// Dispatch functions of the workers with id 0 and 1
+BOOL DispatchCallbackThread1(const CB_CallbackMsg* cbMsg);
+BOOL DispatchCallbackThread2(const CB_CallbackMsg* cbMsg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,6 +1,7 @@
 #include "CentrifugeTest.h"
 #include "StateMachine.h"
 #include "Timer.h"
+#include "Fault.h"
 #include <stdio.h>
 
 BOOL DispatchCallbackThread1(const CB_CallbackMsg* cbMsg);
@@ -9,6 +10,7 @@ BOOL DispatchCallbackThread1(const CB_CallbackMsg* cbMsg);
 typedef struct
 {
     INT speed;
+    TMR_HANDLE pollTimer;
 } CentrifugeTest;
 
 // Define public callback interfaces
@@ -107,6 +109,13 @@ static void CFG_PollCallback(const void* data, void* userData)
     SM_Event(CentrifugeTestSM, CFG_Poll, NULL);
 }
 
+void CFG_Init()
+{
+    // Create the poll timer once; states only start and stop it
+    centrifugeTestObj.pollTimer = TMR_Create(CFG_PollCallback, DispatchCallbackThread1, NULL);
+    ASSERT_TRUE(centrifugeTestObj.pollTimer != NULL);
+}
+
 STATE_DEFINE(Idle, NoEventData)
 {
     printf("%s ST_Idle\n", self->name);
@@ -118,7 +127,7 @@ ENTRY_DEFINE(Idle, NoEventData)
     centrifugeTestObj.speed = 0;
 
     // Stop timer callbacks
-    TMR_Stop(CFG_PollCallback, DispatchCallbackThread1);
+    TMR_StopTimer(centrifugeTestObj.pollTimer);
 }
 
 STATE_DEFINE(Completed, NoEventData)
@@ -162,7 +171,7 @@ STATE_DEFINE(Acceleration, NoEventData)
     printf("%s ST_Acceleration\n", self->name);
 
     // Start polling while waiting for centrifuge to ramp up to speed
-    TMR_Start(CFG_PollCallback, DispatchCallbackThread1, 100);
+    TMR_StartTimer(centrifugeTestObj.pollTimer, TMR_MSEC(100));
 }
 
 // Wait in this state until target centrifuge speed is reached.
@@ -179,7 +188,7 @@ EXIT_DEFINE(WaitForAcceleration)
     printf("%s EX_WaitForAcceleration\n", self->name);
 
     // Acceleration over, stop timer polling
-    TMR_Stop(CFG_PollCallback, DispatchCallbackThread1);
+    TMR_StopTimer(centrifugeTestObj.pollTimer);
 }
 
 // Start decelerating the centrifuge.
@@ -188,7 +197,7 @@ STATE_DEFINE(Deceleration, NoEventData)
     printf("%s ST_Deceleration\n", self->name);
 
     // Start polling while waiting for centrifuge to ramp down to 0
-    TMR_Start(CFG_PollCallback, DispatchCallbackThread1, 100);
+    TMR_StartTimer(centrifugeTestObj.pollTimer, TMR_MSEC(100));
 }
 
 // Wait in this state until centrifuge speed is 0.
@@ -205,7 +214,7 @@ EXIT_DEFINE(WaitForDeceleration)
     printf("%s EX_WaitForDeceleration\n", self->name);
 
     // Deceleration over, stop timer polling
-    TMR_Stop(CFG_PollCallback, DispatchCallbackThread1);
+    TMR_StopTimer(centrifugeTestObj.pollTimer);
 }
 
 
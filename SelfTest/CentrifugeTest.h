@@ -16,6 +16,9 @@ CB_DECLARE(CFG_FailedCb, void*)
 // Declare the private instance of CentrifugeTest state machine
 SM_DECLARE(CentrifugeTestSM)
 
+// Called one time at startup before any events
+void CFG_Init();
+
 // State machine event functions
 EVENT_DECLARE(CFG_Start, NoEventData)
 EVENT_DECLARE(CFG_Cancel, NoEventData)
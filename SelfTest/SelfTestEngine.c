@@ -19,9 +19,10 @@ CB_DEFINE(STE_StatusCb, const SelfTestStatus*, sizeof(SelfTestStatus), 1)
 CB_DEFINE(STE_CompletedCb, void*, 0, 1)
 CB_DEFINE(STE_FailedCb, void*, 0, 1)
 
-// Define private instance of state machine
+// Define private instance of state machine. SelfTestEngine is an active 
+// object; its events execute on Thread1 regardless of the caller's thread.
 SelfTestEngine selfTestEngineObj;
-SM_DEFINE(SelfTestEngineSM, &selfTestEngineObj)
+SM_DEFINE_ACTIVE(SelfTestEngineSM, &selfTestEngineObj, DispatchCallbackThread1, 8)
 
 // Private event
 EVENT_DECLARE(STE_Complete, NoEventData)
@@ -108,11 +109,15 @@ static void STE_FailedCallback(void* data, void* userData)
 
 void STE_Init()
 {
-    // Register with CentrifugeTest and PressureTest state machines
-    CB_Register(CFG_CompletedCb, STE_CompletedCallback, DispatchCallbackThread1, NULL);
-    CB_Register(CFG_FailedCb, STE_FailedCallback, DispatchCallbackThread1, NULL);
-    CB_Register(PRE_CompletedCb, STE_CompletedCallback, DispatchCallbackThread1, NULL);
-    CB_Register(PRE_FailedCb, STE_FailedCallback, DispatchCallbackThread1, NULL);
+    CFG_Init();
+
+    // Register with CentrifugeTest and PressureTest state machines. The 
+    // callbacks only post to the active object's mailbox, so they may run 
+    // directly when the tests publish on DispatchCallbackThread1's thread.
+    CB_RegisterEx(CFG_CompletedCb, STE_CompletedCallback, DispatchCallbackThread1, NULL, CB_REG_DIRECT);
+    CB_RegisterEx(CFG_FailedCb, STE_FailedCallback, DispatchCallbackThread1, NULL, CB_REG_DIRECT);
+    CB_RegisterEx(PRE_CompletedCb, STE_CompletedCallback, DispatchCallbackThread1, NULL, CB_REG_DIRECT);
+    CB_RegisterEx(PRE_FailedCb, STE_FailedCallback, DispatchCallbackThread1, NULL, CB_REG_DIRECT);
 }
 
 STATE_DEFINE(Idle, NoEventData)
@@ -1,5 +1,170 @@
 #include "Fault.h"
 #include "StateMachine.h"
+#include "Atomic.h"
+
+#ifdef USE_SM_ARENA
+#include "ThreadLocal.h"
+
+// A thread's run-to-completion arena
+typedef struct
+{
+    UINT32 depth;           // Nested external events executing on the thread
+    size_t used;            // Bytes allocated in the current cycle
+    UINT64 memory[SM_ARENA_SIZE / sizeof(UINT64)];
+} SM_Arena;
+
+static THREAD_LOCAL SM_Arena _arena;
+
+// Is the event data within the calling thread's arena?
+#define SM_IN_ARENA(_data_) \
+    ((const char*)(_data_) >= (const char*)_arena.memory && \
+     (const char*)(_data_) < (const char*)_arena.memory + sizeof(_arena.memory))
+#endif
+
+static void SM_PostEvent(SM_StateMachine* self, const SM_StateMachineConst* selfConst, const BYTE* transitions, void* pEventData);
+static void SM_FreeEventData(void* pEventData);
+
+// Deletes event data after use. Arena data is released when its cycle ends.
+static void SM_FreeEventData(void* pEventData)
+{
+    if (!pEventData)
+        return;
+
+#ifdef USE_SM_ARENA
+    if (SM_IN_ARENA(pEventData))
+        return;
+#endif
+
+    SM_XFree(pEventData);
+}
+
+#ifdef USE_SM_ARENA
+// Allocates event data from the calling thread's arena when called during a
+// run-to-completion cycle. Otherwise, or if the arena is full, allocates 
+// with SM_XAlloc.
+void* _SM_ArenaAlloc(size_t size)
+{
+    void* pData;
+
+    size = (size + SM_ARENA_ALIGN - 1) & ~(size_t)(SM_ARENA_ALIGN - 1);
+    if (_arena.depth == 0 || size == 0 || size > sizeof(_arena.memory) - _arena.used)
+        return SM_XAlloc(size);
+
+    pData = (char*)_arena.memory + _arena.used;
+    _arena.used += size;
+    return pData;
+}
+#endif
+
+// Called by an event function with its transition map. Executes the event 
+// now, or queues it to the owning task if the state machine is active.
+void _SM_Event(SM_StateMachine* self, const SM_StateMachineConst* selfConst, const BYTE* transitions, void* pEventData)
+{
+    ASSERT_TRUE(self);
+    ASSERT_TRUE(transitions);
+
+#ifdef USE_SM_ARENA
+    // Arena data does not outlive the cycle, so it cannot be queued
+    ASSERT_TRUE(!self->mailbox || !pEventData || !SM_IN_ARENA(pEventData));
+#endif
+
+    if (self->mailbox)
+        SM_PostEvent(self, selfConst, transitions, pEventData);
+    else
+        _SM_ExternalEvent(self, selfConst, transitions[self->currentState], pEventData);
+}
+
+// Queues an event into an active state machine mailbox. The current state 
+// is not read here; the transition map is applied on the owning task.
+static void SM_PostEvent(SM_StateMachine* self, const SM_StateMachineConst* selfConst, const BYTE* transitions, void* pEventData)
+{
+    SM_Mailbox* mailbox = self->mailbox;
+    SM_MailboxEntry* entry;
+    UINT32 tail;
+
+    // Mailbox size must be a power of 2
+    ASSERT_TRUE(mailbox->maxEntries && (mailbox->maxEntries & (mailbox->maxEntries - 1)) == 0);
+
+    // Reserve an entry. The head may only advance, so a stale read is safe.
+    do
+    {
+        tail = ATOMIC_Load32(&mailbox->tail);
+        if (tail - ATOMIC_Load32(&mailbox->head) >= mailbox->maxEntries)
+        {
+            // Mailbox full. Event is lost.
+            ASSERT();
+            SM_FreeEventData(pEventData);
+            return;
+        }
+    } while (!ATOMIC_CompareExchange32(&mailbox->tail, tail, tail + 1));
+
+    entry = &mailbox->entries[tail & (mailbox->maxEntries - 1)];
+    entry->selfConst = selfConst;
+    entry->pEventData = pEventData;
+
+    // Publish the entry to the consumer
+    ATOMIC_StorePtr(&entry->transitions, transitions);
+
+    // The first pending event schedules the mailbox onto the owning task. 
+    // Later events are picked up by the drain already in progress.
+    if (ATOMIC_Add32(&mailbox->pending, 1) == 1)
+    {
+        if (!mailbox->dispatchFunc(&mailbox->drainMsg))
+            ASSERT();
+    }
+}
+
+// Executes pending mailbox events on the owning task. Invoked through the 
+// mailbox drainMsg callback message.
+void _SM_MailboxDrain(const void* cbData, void* cbUserData)
+{
+    SM_StateMachine* self = (SM_StateMachine*)cbUserData;
+    SM_Mailbox* mailbox;
+    SM_MailboxEntry* entry;
+    const SM_StateMachineConst* selfConst;
+    const BYTE* transitions;
+    void* pEventData;
+    UINT32 budget;
+
+    (void)cbData;
+
+    ASSERT_TRUE(self);
+    ASSERT_TRUE(self->mailbox);
+    mailbox = self->mailbox;
+
+    // Limit events per drain so other messages on the task are not starved
+    budget = mailbox->maxEntries;
+
+    do
+    {
+        entry = &mailbox->entries[mailbox->head & (mailbox->maxEntries - 1)];
+
+        // Wait for a producer that reserved the entry to finish publishing it
+        while ((transitions = ATOMIC_LoadPtr(&entry->transitions)) == NULL)
+            ATOMIC_Yield();
+
+        selfConst = entry->selfConst;
+        pEventData = entry->pEventData;
+
+        // Release the entry to producers
+        ATOMIC_StorePtr(&entry->transitions, NULL);
+        ATOMIC_Store32(&mailbox->head, mailbox->head + 1);
+
+        // Run the event to completion
+        _SM_ExternalEvent(self, selfConst, transitions[self->currentState], pEventData);
+
+        if (--budget == 0)
+        {
+            // More events pending? Reschedule behind other queued messages.
+            if (ATOMIC_Add32(&mailbox->pending, (UINT32)-1) != 0)
+            {
+                if (!mailbox->dispatchFunc(&mailbox->drainMsg))
+                    ASSERT();
+            }
+            return;
+        }
+    } while (ATOMIC_Add32(&mailbox->pending, (UINT32)-1) != 0);
+}
 
 // Generates an external event. Called once per external event 
 // to start the state machine executing
@@ -9,12 +174,18 @@ void _SM_ExternalEvent(SM_StateMachine* self, const SM_StateMachineConst* selfCo
     if (newState == EVENT_IGNORED) 
     {
         // Just delete the event data, if any
-        if (pEventData)
-            SM_XFree(pEventData);
+        SM_FreeEventData(pEventData);
     }
     else 
     {
-        // TODO - capture software lock here for thread-safety if necessary
+        // No lock is taken. An active state machine executes events one at 
+        // a time on its owning task. Otherwise the caller must ensure a single
+        // thread generates events.
+
+#ifdef USE_SM_ARENA
+        // Start, or nest within, the thread's run-to-completion cycle
+        _arena.depth++;
+#endif
 
         // Generate the event 
         _SM_InternalEvent(self, newState, pEventData);
@@ -25,7 +196,11 @@ void _SM_ExternalEvent(SM_StateMachine* self, const SM_StateMachineConst* selfCo
         else
             _SM_StateEngineEx(self, selfConst);
 
-        // TODO - release software lock here 
+#ifdef USE_SM_ARENA
+        // Release all arena data of the cycle at once
+        if (--_arena.depth == 0)
+            _arena.used = 0;
+#endif
     }
 }
 
@@ -74,11 +249,8 @@ void _SM_StateEngine(SM_StateMachine* self, const SM_StateMachineConst* selfCons
         state(self, pDataTemp);
 
         // If event data was used, then delete it
-        if (pDataTemp)
-        {
-            SM_XFree(pDataTemp);
-            pDataTemp = NULL;
-        }
+        SM_FreeEventData(pDataTemp);
+        pDataTemp = NULL;
     }
 }
 
@@ -143,10 +315,7 @@ void _SM_StateEngineEx(SM_StateMachine* self, const SM_StateMachineConst* selfCo
         }
 
         // If event data was used, then delete it
-        if (pDataTemp)
-        {
-            SM_XFree(pDataTemp);
-            pDataTemp = NULL;
-        }
+        SM_FreeEventData(pDataTemp);
+        pDataTemp = NULL;
     }
 }
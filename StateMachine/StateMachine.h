@@ -12,12 +12,29 @@
 // machine features. 
 //
 // Macros are used to assist in creating the state machine machinery. 
+//
+// A state machine defined with SM_DEFINE_ACTIVE is an active object. It owns
+// a bounded event mailbox bound to an OS task dispatch function. SM_Event() 
+// may be called from any thread; the event is queued and executes to 
+// completion on the owning task. Events are executed one at a time in the 
+// order they were posted. The task may be a thread pool; the machine then 
+// runs on any pool thread but never on two threads at once.
+//
+// With USE_SM_ARENA defined, event data for SM_InternalEvent() may be 
+// created with SM_XAllocInternal(). During a run-to-completion cycle the data 
+// comes from a per-thread arena by bumping a pointer, and the whole arena 
+// is reset in one step when the cycle ends. Such data is only valid until
+// the outermost external event returns, so pass it to SM_InternalEvent() 
+// or to an event of a state machine executed on the same thread, never to 
+// an active object. Outside a cycle, or once the arena is full, 
+// SM_XAllocInternal() falls back to SM_XAlloc().
 
 #ifndef _STATE_MACHINE_H
 #define _STATE_MACHINE_H
 
 #include "DataTypes.h"
 #include "Fault.h"
+#include "callback.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,6 +52,19 @@ extern "C" {
     #define SM_XFree(ptr)      free(ptr)
 #endif
 
+// Define USE_SM_ARENA to allocate internal event data from a per-thread arena
+// #define USE_SM_ARENA
+
+// Arena bytes per thread. Allocations are rounded up to SM_ARENA_ALIGN bytes.
+#define SM_ARENA_SIZE       1024
+#define SM_ARENA_ALIGN      8
+
+#ifdef USE_SM_ARENA
+    #define SM_XAllocInternal(size)    _SM_ArenaAlloc(size)
+#else
+    #define SM_XAllocInternal(size)    SM_XAlloc(size)
+#endif
+
 enum { EVENT_IGNORED = 0xFE, CANNOT_HAPPEN = 0xFF };
 
 typedef void NoEventData;
@@ -48,6 +78,27 @@ typedef struct
     const struct SM_StateStructEx* stateMapEx;
 } SM_StateMachineConst;
 
+// Active object mailbox entry
+typedef struct
+{
+    const SM_StateMachineConst* selfConst;
+    const BYTE* volatile transitions;   // NULL while the entry is empty
+    void* pEventData;
+} SM_MailboxEntry;
+
+// Active object mailbox. A bounded multiple producer, single consumer ring
+// of pending external events executed on the task of dispatchFunc.
+typedef struct
+{
+    SM_MailboxEntry* const entries;
+    const UINT32 maxEntries;            // Must be a power of 2
+    const CB_DispatchCallbackFuncType dispatchFunc;
+    CB_CallbackMsg drainMsg;            // Posted to dispatchFunc when events are pending
+    volatile UINT32 head;               // Next entry to execute
+    volatile UINT32 tail;               // Next entry to reserve
+    volatile UINT32 pending;            // Posted events not yet executed
+} SM_Mailbox;
+
 // State machine instance data
 typedef struct 
 {
@@ -57,6 +108,7 @@ typedef struct
     BYTE currentState;
     BOOL eventGenerated;
     void* pEventData;
+    SM_Mailbox* mailbox;                // NULL unless an active object
 } SM_StateMachine;
 
 // Generic state function signatures
@@ -91,17 +143,31 @@ typedef struct SM_StateStructEx
     (_instance_*)(self->pInstance);
 
 // Private functions
+void _SM_Event(SM_StateMachine* self, const SM_StateMachineConst* selfConst, const BYTE* transitions, void* pEventData);
+void _SM_MailboxDrain(const void* cbData, void* cbUserData);
 void _SM_ExternalEvent(SM_StateMachine* self, const SM_StateMachineConst* selfConst, BYTE newState, void* pEventData);
 void _SM_InternalEvent(SM_StateMachine* self, BYTE newState, void* pEventData);
 void _SM_StateEngine(SM_StateMachine* self, const SM_StateMachineConst* selfConst);
 void _SM_StateEngineEx(SM_StateMachine* self, const SM_StateMachineConst* selfConst);
+void* _SM_ArenaAlloc(size_t size);
 
 #define SM_DECLARE(_smName_) \
     extern SM_StateMachine _smName_##Obj; 
 
 #define SM_DEFINE(_smName_, _instance_) \
     SM_StateMachine _smName_##Obj = { #_smName_, _instance_, \
-        0, 0, 0, 0 }; 
+        0, 0, 0, 0, NULL }; 
+
+// Define an active object state machine. Events execute on the OS task of 
+// _dispatchFunc_. _maxEvents_ is the mailbox size and must be a power of 2.
+// e.g. SM_DEFINE_ACTIVE(MySM, &myObj, DispatchCallbackThread1, 16)
+#define SM_DEFINE_ACTIVE(_smName_, _instance_, _dispatchFunc_, _maxEvents_) \
+    extern SM_StateMachine _smName_##Obj; \
+    static SM_MailboxEntry _smName_##MailboxEntries[_maxEvents_]; \
+    static SM_Mailbox _smName_##Mailbox = { _smName_##MailboxEntries, _maxEvents_, _dispatchFunc_, \
+        { _SM_MailboxDrain, NULL, &_smName_##Obj, CB_MSG_STATIC, { NULL } }, 0, 0, 0 }; \
+    SM_StateMachine _smName_##Obj = { #_smName_, _instance_, \
+        0, 0, 0, 0, &_smName_##Mailbox }; 
 
 #define EVENT_DECLARE(_eventFunc_, _eventData_) \
     void _eventFunc_(SM_StateMachine* self, _eventData_* pEventData);
@@ -174,7 +240,7 @@ void _SM_StateEngineEx(SM_StateMachine* self, const SM_StateMachineConst* selfCo
 
 #define END_TRANSITION_MAP(_smName_, _eventData_) \
     }; \
-    _SM_ExternalEvent(self, &_smName_##Const, TRANSITIONS[self->currentState], _eventData_); \
+    _SM_Event(self, &_smName_##Const, TRANSITIONS, _eventData_); \
     C_ASSERT((sizeof(TRANSITIONS)/sizeof(BYTE)) == (sizeof(_smName_##StateMap)/sizeof(_smName_##StateMap[0])));
 
 #ifdef __cplusplus
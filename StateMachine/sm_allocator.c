@@ -4,6 +4,18 @@
 #include "sm_allocator.h"
 #include "x_allocator.h"
 
+#ifdef SMALLOC_POOLS_HEADER
+// Use the pools generated by the PoolSizer tool from a profile of this 
+// allocator, e.g. -DSMALLOC_POOLS_HEADER=\"sm_pools.h\"
+#include SMALLOC_POOLS_HEADER
+
+SMALLOC_POOLS
+
+// An array of allocators sorted by smallest block first
+static ALLOC_Allocator* allocators[] = {
+    SMALLOC_ALLOCATORS
+};
+#else
 // Maximum number of blocks for each size
 #define MAX_32_BLOCKS   10
 #define MAX_128_BLOCKS	5
@@ -12,19 +24,20 @@
 #define BLOCK_32_SIZE     32 + XALLOC_BLOCK_META_DATA_SIZE
 #define BLOCK_128_SIZE    128 + XALLOC_BLOCK_META_DATA_SIZE
 
-// Define individual fb_allocators
-ALLOC_DEFINE(smDataAllocator32, BLOCK_32_SIZE, MAX_32_BLOCKS)
-ALLOC_DEFINE(smDataAllocator128, BLOCK_128_SIZE, MAX_128_BLOCKS)
+// Define individual fb_allocators. Blocks are 16 byte aligned for SIMD access.
+ALLOC_DEFINE_ALIGNED(smDataAllocator32, BLOCK_32_SIZE, MAX_32_BLOCKS, 16)
+ALLOC_DEFINE_ALIGNED(smDataAllocator128, BLOCK_128_SIZE, MAX_128_BLOCKS, 16)
 
 // An array of allocators sorted by smallest block first
 static ALLOC_Allocator* allocators[] = {
     &smDataAllocator32Obj,
     &smDataAllocator128Obj
 };
+#endif
 
 #define MAX_ALLOCATORS   (sizeof(allocators) / sizeof(allocators[0]))
 
-static XAllocData self = { allocators, MAX_ALLOCATORS };
+static XAllocData self = XALLOC_DATA_INIT(allocators, MAX_ALLOCATORS);
 
 //----------------------------------------------------------------------------
 // SMALLOC_Alloc
@@ -58,3 +71,10 @@ void* SMALLOC_Calloc(size_t num, size_t size)
     return XALLOC_Calloc(&self, num, size);
 }
 
+//----------------------------------------------------------------------------
+// SMALLOC_ProfileSave
+//----------------------------------------------------------------------------
+BOOL SMALLOC_ProfileSave(const char* fileName)
+{
+    return XALLOC_ProfileSave(&self, "SMALLOC", fileName);
+}
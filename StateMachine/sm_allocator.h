@@ -1,6 +1,7 @@
 #ifndef _SM_ALLOCATOR_H
 #define _SM_ALLOCATOR_H
 
+#include "DataTypes.h"
 #include <stddef.h>
 
 #ifdef __cplusplus
@@ -12,6 +13,10 @@ void SMALLOC_Free(void* ptr);
 void* SMALLOC_Realloc(void *ptr, size_t new_size);
 void* SMALLOC_Calloc(size_t num, size_t size);
 
+// Write the request size profile recorded with USE_XALLOC_PROFILE to a file
+// for the PoolSizer tool. Returns FALSE if profiling is disabled.
+BOOL SMALLOC_ProfileSave(const char* fileName);
+
 #ifdef __cplusplus
 }
 #endif
@@ -2,6 +2,8 @@
 #include "WorkerThreadStd.h"
 #include "Timer.h"
 #include "fb_allocator.h"
+#include "callback_allocator.h"
+#include "sm_allocator.h"
 
 // @see https://github.com/endurodave/C_StateMachineWithThreads
 // David Lafreniere
@@ -31,6 +33,15 @@ void STE_FailedCallback(void* data, void* userData)
     selfTestEngineCompleted = TRUE;
 }
 
+// Print one allocator's statistics
+void ALLOC_StatsCallback(const ALLOC_Stats* stats, void* userData)
+{
+    printf("%s: blockSize=%u inUse=%u maxInUse=%u/%u cached=%u allocs=%llu failures=%llu overflow=%llu\n",
+        stats->name, (unsigned)stats->blockSize, stats->blocksInUse, stats->maxBlocksInUse,
+        stats->maxBlocks, stats->cachedBlocks, (unsigned long long)stats->allocations, 
+        (unsigned long long)stats->failures, (unsigned long long)stats->overflowAllocations);
+}
+
 int main()
 {
     // Initialize modules
@@ -54,6 +65,15 @@ int main()
 
     // Cleanup before exit
     ExitThreads();
+
+    // Report fixed block pool usage, including blocks cached by this thread
+    ALLOC_FlushThreadCache();
+    ALLOC_IterateStats(ALLOC_StatsCallback, NULL);
+
+    // Save request size profiles for PoolSizer if built with USE_XALLOC_PROFILE
+    CBALLOC_ProfileSave("cballoc_profile.txt");
+    SMALLOC_ProfileSave("smalloc_profile.txt");
+
     CB_Term();
     TMR_Term();
     ALLOC_Term();